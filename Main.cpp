@@ -17,12 +17,20 @@
  */
 
 #include <iostream>
+#include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
 #include <SDL/SDL.h>
 #include <SDL/SDL_opengl.h>
 #include <getopt.h>
+#include <atomic>
+#include <chrono>
 #include "libgbpp/GameBoy.h"
+#include "libgbpp/RingBuffer.h"
+#include "libgbpp/Scaler.h"
+#include "libgbpp/AudioCapture.h"
+#include "libgbpp/VideoCapture.h"
 
 using namespace gbpp;
 
@@ -32,6 +40,20 @@ unsigned int HEIGHT = GameBoy::HEIGHT;
 // Screen magnification
 int magnification = 1;
 int color_scheme = 0;
+int frameskip = 0;
+int ppu = GameBoy::PPU_SCANLINE;
+
+// How the frames get to the screen
+enum { RENDERER_PIXELS, RENDERER_TEXTURE };
+int renderer = RENDERER_TEXTURE;
+
+// Optional CPU upscaling filter (-1 for none), it runs on a worker
+// thread while the emulation does the next frame.
+int filter = -1;
+Scaler *scaler = 0;
+int frame_width = GameBoy::WIDTH;
+int frame_height = GameBoy::HEIGHT;
+int frame_bytes = 3;
 bool hflag = false;
 bool cflag = false;
 bool vflag = false;
@@ -41,13 +63,100 @@ unsigned int fps = 0;
 
 GameBoy game_boy;
 
+// The emulation runs in its own thread and hands the frames to the
+// render thread (the main thread, it owns the OpenGL context) through
+// a small queue. Input goes the other way through another queue.
+const int MAX_SCALE = 4;
+
+struct Frame {
+	byte pixels[GameBoy::HEIGHT * MAX_SCALE * GameBoy::WIDTH * MAX_SCALE * 4];
+};
+
+enum { INPUT_KEY_PRESSED, INPUT_KEY_RELEASED, INPUT_COLOR_SCHEME };
+
+struct Input {
+	int type;
+	int value;
+};
+
+const int FRAME_QUEUE_SIZE = 3;
+RingBuffer<Frame> frames(FRAME_QUEUE_SIZE);
+RingBuffer<Input> inputs(64);
+std::atomic<bool> running(true);
+std::atomic<unsigned int> dropped_frames(0);
+
+// Texture renderer: the frame is streamed into a persistent texture,
+// through a pixel buffer object when the driver has one.
+GLuint screen_texture = 0;
+GLuint pixel_buffer = 0;
+// Part of the texture covered by the frame, less than 1 when the texture
+// had to be rounded up to powers of two
+float texture_s = 1;
+float texture_t = 1;
+PFNGLGENBUFFERSPROC gl_gen_buffers = 0;
+PFNGLBINDBUFFERPROC gl_bind_buffer = 0;
+PFNGLBUFFERDATAPROC gl_buffer_data = 0;
+PFNGLMAPBUFFERPROC gl_map_buffer = 0;
+PFNGLUNMAPBUFFERPROC gl_unmap_buffer = 0;
+
+// Time spent uploading and drawing the frames, for the caption
+double upload_time = 0;
+
+// --upload-log n: average upload time of every n frames on stderr, the
+// driver work is waited for (glFinish) so it is counted too
+int upload_log = 0;
+double upload_log_time = 0;
+int upload_log_frames = 0;
+
+// Sound: the emulation thread queues the samples of every frame and the
+// SDL audio thread takes them. The emulation waits while more than
+// AUDIO_LATENCY samples are queued, so the audio clock paces the frames,
+// and makes up to 0.5% more or less samples to keep the queue there.
+bool sound = true;
+const int AUDIO_RATE = 44100;
+const int AUDIO_BUFFER = 1024;  // samples of a callback
+const int AUDIO_LATENCY = 2048; // samples queued, about 46 ms
+const double MAX_RATE_DELTA = 0.005;
+RingBuffer<short> audio_samples(AUDIO_LATENCY * 2 * 4);
+std::atomic<unsigned int> audio_underruns(0);
+std::atomic<unsigned int> audio_overflows(0); // samples dropped, the queue was full
+
+// Sound capture: the samples of every frame to a WAV (raw if the name
+// ends in .raw) file and/or their hashes. Headless runs that many frames
+// without SDL, as fast as possible and with a fixed rate, so the same
+// rom gives the same capture every time.
+const char *audio_out = 0;
+const char *audio_hash = 0;
+int headless_frames = 0;
+AudioCapture capture;
+
+// Video capture: every emulated frame to a Y4M (raw I420 if the name
+// ends in .yuv) file, "-" pipes it to an encoder
+const char *video_out = 0;
+VideoCapture video;
+
 void show_version();
 void show_usage();
 void show_copyright();
 void init_sdl();
 void init_opengl();
+void init_texture();
+bool has_gl_version(const int major, const int minor);
+bool has_gl_extension(const char *name);
+int power_of_two(const int size);
+bool init_audio();
+void audio_callback(void *data, Uint8 *stream, int len);
+void queue_audio();
+void wait_audio();
+void wait_timer(const unsigned int before);
+bool init_capture();
+void capture_audio();
+void capture_video(const byte *pixels);
+void headless_loop();
+GLenum frame_format();
 void emulation_loop();
-void update_screen();
+int emulation_thread(void *data);
+void update_screen(const Frame *frame);
 void check_input(SDL_Event event);
 void check_colorscheme_change(const SDL_Event event);
 
@@ -60,12 +169,22 @@ int main(int argc, char *argv[]) {
 		{"skip-bios", no_argument, 0, 'k'},
 		{"magnification", required_argument, 0, 'm'},
 		{"color-scheme", required_argument, 0, 's'},
+		{"renderer", required_argument, 0, 'r'},
+		{"filter", required_argument, 0, 'f'},
+		{"frameskip", required_argument, 0, 'n'},
+		{"ppu", required_argument, 0, 'p'},
+		{"audio", required_argument, 0, 'a'},
+		{"audio-out", required_argument, 0, 'o'},
+		{"audio-hash", required_argument, 0, 'H'},
+		{"headless", required_argument, 0, 'x'},
+		{"video-out", required_argument, 0, 'V'},
+		{"upload-log", required_argument, 0, 'u'},
 		{"help", no_argument, 0, 'h'},
 		{"copyright", no_argument, 0, 'c'},
 		{0, 0, 0, 0}
 	};
 
-	while((c = getopt_long(argc, argv, "s:hcvm:k", long_options, &option_index)) != -1) {
+	while((c = getopt_long(argc, argv, "s:hcvm:kr:f:n:p:a:o:H:x:V:u:", long_options, &option_index)) != -1) {
 		switch (c) {
 		case 'm':
 			if(atoi(optarg) >= 1 && atoi(optarg) <= 4) {
@@ -77,6 +196,64 @@ int main(int argc, char *argv[]) {
 				color_scheme = atoi(optarg);
 			}
 			break;
+		case 'r':
+			if(strcmp(optarg, "pixels") == 0) {
+				renderer = RENDERER_PIXELS;
+			} else if(strcmp(optarg, "texture") == 0) {
+				renderer = RENDERER_TEXTURE;
+			}
+			break;
+		case 'f':
+			if(strcmp(optarg, "nearest") == 0) {
+				filter = FILTER_NEAREST;
+			} else if(strcmp(optarg, "scale2x") == 0) {
+				filter = FILTER_SCALE2X;
+			} else if(strcmp(optarg, "scale3x") == 0) {
+				filter = FILTER_SCALE3X;
+			} else if(strcmp(optarg, "blend2x") == 0) {
+				filter = FILTER_BLEND2X;
+			}
+			break;
+		case 'n':
+			if(strcmp(optarg, "auto") == 0) {
+				frameskip = GameBoy::FRAMESKIP_AUTO;
+			} else if(atoi(optarg) >= 0) {
+				frameskip = atoi(optarg);
+			}
+			break;
+		case 'p':
+			if(strcmp(optarg, "scanline") == 0) {
+				ppu = GameBoy::PPU_SCANLINE;
+			} else if(strcmp(optarg, "fifo") == 0) {
+				ppu = GameBoy::PPU_FIFO;
+			}
+			break;
+		case 'a':
+			if(strcmp(optarg, "on") == 0) {
+				sound = true;
+			} else if(strcmp(optarg, "off") == 0) {
+				sound = false;
+			}
+			break;
+		case 'o':
+			audio_out = optarg;
+			break;
+		case 'H':
+			audio_hash = optarg;
+			break;
+		case 'V':
+			video_out = optarg;
+			break;
+		case 'x':
+			if(atoi(optarg) > 0) {
+				headless_frames = atoi(optarg);
+			}
+			break;
+		case 'u':
+			if(atoi(optarg) > 0) {
+				upload_log = atoi(optarg);
+			}
+			break;
 		case 'k':
 			skip_bios_flag = true;
 			break;
@@ -92,6 +269,18 @@ int main(int argc, char *argv[]) {
 		}
 	}
 	
+	if(filter != -1) {
+		// The filters work on 32 bit pixels
+		scaler = new Scaler(filter, magnification);
+		if(magnification < scaler->get_factor()) {
+			magnification = scaler->get_factor();
+		}
+		frame_width *= scaler->get_factor();
+		frame_height *= scaler->get_factor();
+		frame_bytes = 4;
+		game_boy.set_framebuffer(NULL, GameBoy::FORMAT_RGBA32, 0);
+	}
+
 	WIDTH *= magnification;
 	HEIGHT *= magnification;
 	
@@ -113,15 +302,38 @@ int main(int argc, char *argv[]) {
 	
 	try {
 		game_boy.use_color_scheme(color_scheme);
+		game_boy.set_frameskip(frameskip);
+		game_boy.set_ppu(ppu);
 		game_boy.power_on(argv[0], skip_bios_flag);
 	} catch(BadCartridge e) {
 		std::cerr << e.what() << std::endl;
 		exit(EXIT_FAILURE);
 	}
 	
+	if(headless_frames > 0) {
+		game_boy.set_sample_rate(AUDIO_RATE);
+		game_boy.set_audio_enabled(audio_out || audio_hash);
+		if(!init_capture()) {
+			exit(EXIT_FAILURE);
+		}
+		headless_loop();
+		delete scaler;
+		return capture.failed() || video.failed() ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 	init_sdl();
 	init_opengl();
+	if(sound) {
+		sound = init_audio();
+	}
+	game_boy.set_audio_enabled(sound || audio_out || audio_hash);
+	if(!init_capture()) {
+		exit(EXIT_FAILURE);
+	}
 	emulation_loop();
+	capture.close();
+	video.close();
+	delete scaler;
 	return EXIT_SUCCESS;
 }
 
@@ -155,14 +367,141 @@ void init_opengl() {
 	glDisable(GL_BLEND);
 	glDisable(GL_FOG);
 	glClearColor(0, 0, 0, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if(renderer == RENDERER_TEXTURE) {
+		init_texture();
+	}
 }
 
-void update_screen() {
-	//glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
- 	//glLoadIdentity();
- 	glRasterPos2i(-1, 1);
-	glPixelZoom(magnification, magnification * -1);
- 	glDrawPixels(Lcd::WIDTH, Lcd::HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, lcd.screen); // TODO: hide the lcd from here.
+void init_texture() {
+	glGenTextures(1, &screen_texture);
+	glBindTexture(GL_TEXTURE_2D, screen_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	// 160x144 needs non power of two textures (OpenGL 2.0), or the frame
+	// is put in the corner of a bigger power of two one
+	int texture_width = frame_width;
+	int texture_height = frame_height;
+	if(!has_gl_version(2, 0) && !has_gl_extension("GL_ARB_texture_non_power_of_two")) {
+		texture_width = power_of_two(frame_width);
+		texture_height = power_of_two(frame_height);
+	}
+	texture_s = frame_width / static_cast<float>(texture_width);
+	texture_t = frame_height / static_cast<float>(texture_height);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, texture_width, texture_height, 0,
+		frame_format(), GL_UNSIGNED_BYTE, NULL);
+
+	// The entry points can be there without the driver supporting them,
+	// only the version or the extension tells
+	if(!has_gl_version(2, 1) && !has_gl_extension("GL_ARB_pixel_buffer_object")) {
+		return;
+	}
+	gl_gen_buffers = (PFNGLGENBUFFERSPROC) SDL_GL_GetProcAddress("glGenBuffers");
+	gl_bind_buffer = (PFNGLBINDBUFFERPROC) SDL_GL_GetProcAddress("glBindBuffer");
+	gl_buffer_data = (PFNGLBUFFERDATAPROC) SDL_GL_GetProcAddress("glBufferData");
+	gl_map_buffer = (PFNGLMAPBUFFERPROC) SDL_GL_GetProcAddress("glMapBuffer");
+	gl_unmap_buffer = (PFNGLUNMAPBUFFERPROC) SDL_GL_GetProcAddress("glUnmapBuffer");
+	if(gl_gen_buffers && gl_bind_buffer && gl_buffer_data && gl_map_buffer && gl_unmap_buffer) {
+		gl_gen_buffers(1, &pixel_buffer);
+	}
+}
+
+bool has_gl_version(const int major, const int minor) {
+	const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+	int gl_major = 0;
+	int gl_minor = 0;
+	if(!version || sscanf(version, "%d.%d", &gl_major, &gl_minor) != 2) {
+		return false;
+	}
+	return gl_major > major || (gl_major == major && gl_minor >= minor);
+}
+
+// Whole names only, GL_ARB_foo must not match GL_ARB_foo_bar
+bool has_gl_extension(const char *name) {
+	const char *extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+	if(!extensions) {
+		return false;
+	}
+	const size_t length = strlen(name);
+	for(const char *found = strstr(extensions, name); found; found = strstr(found + length, name)) {
+		if((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int power_of_two(const int size) {
+	int power = 1;
+	while(power < size) {
+		power *= 2;
+	}
+	return power;
+}
+
+GLenum frame_format() {
+	return frame_bytes == 4 ? GL_RGBA : GL_RGB;
+}
+
+void update_screen(const Frame *frame) {
+	const int frame_size = frame_width * frame_height * frame_bytes;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if(renderer == RENDERER_PIXELS) {
+		glRasterPos2i(-1, 1);
+		const float zoom = magnification * GameBoy::WIDTH / static_cast<float>(frame_width);
+		glPixelZoom(zoom, -zoom);
+		glDrawPixels(frame_width, frame_height, frame_format(), GL_UNSIGNED_BYTE, frame->pixels);
+	} else {
+		const void *pixels = frame->pixels;
+		if(pixel_buffer) {
+			// Orphan the old storage, so the driver does not wait for the
+			// previous upload, and let the texture read from the buffer
+			gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+			gl_buffer_data(GL_PIXEL_UNPACK_BUFFER, frame_size, NULL, GL_STREAM_DRAW);
+			void *mapped = gl_map_buffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+			if(mapped) {
+				memcpy(mapped, frame->pixels, frame_size);
+				gl_unmap_buffer(GL_PIXEL_UNPACK_BUFFER);
+				pixels = 0; // offset into the buffer
+			} else {
+				gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame_width, frame_height,
+			frame_format(), GL_UNSIGNED_BYTE, pixels);
+		if(pixel_buffer) {
+			gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+
+		// The first line of the frame is at the top of the window
+		glBegin(GL_QUADS);
+		glTexCoord2f(0, 0); glVertex2f(-1, 1);
+		glTexCoord2f(texture_s, 0); glVertex2f(1, 1);
+		glTexCoord2f(texture_s, texture_t); glVertex2f(1, -1);
+		glTexCoord2f(0, texture_t); glVertex2f(-1, -1);
+		glEnd();
+	}
+
+	if(upload_log > 0) {
+		glFinish();
+	}
+	const double elapsed = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	upload_time += elapsed;
+	if(upload_log > 0) {
+		upload_log_time += elapsed;
+		if(++upload_log_frames == upload_log) {
+			std::cerr << (renderer == RENDERER_PIXELS ? "pixels" : (pixel_buffer ? "texture+pbo" : "texture"))
+				<< " " << magnification << "x " << frame_width << "x" << frame_height << ": "
+				<< upload_log_time / upload_log_frames << " ms/frame" << std::endl;
+			upload_log_time = 0;
+			upload_log_frames = 0;
+		}
+	}
 	glFlush();
 	SDL_GL_SwapBuffers();
 }
@@ -196,7 +535,8 @@ void check_input(const SDL_Event event) {
 				key = GameBoy::KEY_DOWN;
 		}
 		if(key != -1) {
-			game_boy.key_pressed(key);
+			Input input = { INPUT_KEY_PRESSED, key };
+			inputs.push(input);
 		}
 	} else if(event.type == SDL_KEYUP) {
 		switch(event.key.keysym.sym) {
@@ -226,7 +566,8 @@ void check_input(const SDL_Event event) {
 				break;
 		}
 		if(key != -1) {
-			game_boy.key_released(key);
+			Input input = { INPUT_KEY_RELEASED, key };
+			inputs.push(input);
 		}
 	}
 }
@@ -257,24 +598,21 @@ void check_colorscheme_change(const SDL_Event event) {
 		}
 	}
 	if(scheme != -1) {
-		game_boy.use_color_scheme(scheme);	
+		Input input = { INPUT_COLOR_SCHEME, scheme };
+		inputs.push(input);
 	}
 }
 
+// Render thread: events, drawing and buffer swaps
 void emulation_loop() {
 	SDL_Event event;
-	bool running = true;
+	unsigned int second = SDL_GetTicks();
+	unsigned int skipped_frames = 0;
+	char buffer[80];
 
-	const float MILI_FPS = (1000.0 / GameBoy::FPS);
-	const unsigned int FRAME_ADJUST = 40;
-	unsigned int second = 0;
-	float time_to_sleep;
-	unsigned int before;
-	unsigned int after;
-	char buffer[30];
+	SDL_Thread *emulation = SDL_CreateThread(emulation_thread, NULL);
 
 	while(running) {
-		before = SDL_GetTicks();
 		while(SDL_PollEvent(&event)) {
 			check_input(event);
 			check_colorscheme_change(event);
@@ -287,35 +625,227 @@ void emulation_loop() {
 				}
 			}
 		}
-		game_boy.frame(); // do a frame
-		update_screen(); // update based on the last frame
-		after = SDL_GetTicks();
-		
-		// Adjust 60 fps
-		// Bacause 1000/60 = 16.6666
-		// I need to adjust to render 60 frames in one second
-		// so I do (40 * 17) + (20 * 16) = 1000
-		if(fps <= FRAME_ADJUST) {
-			time_to_sleep = round(MILI_FPS) - (after - before);
-		} else {
-			time_to_sleep = static_cast<unsigned int>(MILI_FPS) - (after - before);
+
+		// Show only the newest frame if the display fell behind
+		while(frames.size() > 1) {
+			frames.pop();
+			skipped_frames++;
 		}
-		
-		if(time_to_sleep > 0 && time_to_sleep < MILI_FPS) {
-			SDL_Delay(time_to_sleep);
+
+		const Frame *frame = frames.front();
+		if(!frame) {
+			SDL_Delay(1);
+			continue;
 		}
+		update_screen(frame); // update based on the last frame
+		frames.pop();
+		fps++;
 
-		if(second <= 1000) {
-			second += (SDL_GetTicks() - before);
-			fps++;
-		} else {
-			sprintf(buffer, "%d fps (%.1lf%%)", fps,
-				(100 * fps) / static_cast<float>(GameBoy::FPS));
+		if(SDL_GetTicks() - second >= 1000) {
+			sprintf(buffer, "%d fps (%.1lf%%) %u dropped %.3lf ms/frame %u underruns %u overflows", fps,
+				(100 * fps) / static_cast<float>(GameBoy::FPS), dropped_frames + skipped_frames,
+				fps > 0 ? upload_time / fps : 0.0, audio_underruns.load(), audio_overflows.load());
 			SDL_WM_SetCaption(buffer, NULL);
-			second = 0;
+			second = SDL_GetTicks();
 			fps = 0;
+			upload_time = 0;
+		}
+	}
+
+	SDL_WaitThread(emulation, NULL);
+	if(sound) {
+		SDL_CloseAudio();
+	}
+}
+
+// Emulation thread: input, frames at the audio rate (60 fps without
+// sound) and frame hand off
+int emulation_thread(void *data) {
+	unsigned int before;
+	Input input;
+	bool scaling = false;
+
+	while(running) {
+		before = SDL_GetTicks();
+		while(inputs.pop(input)) {
+			if(input.type == INPUT_KEY_PRESSED) {
+				game_boy.key_pressed(input.value);
+			} else if(input.type == INPUT_KEY_RELEASED) {
+				game_boy.key_released(input.value);
+			} else {
+				game_boy.use_color_scheme(input.value);
+			}
+		}
+
+		game_boy.frame(); // do a frame
+
+		// The previous frame was scaled while this one was emulated
+		if(scaling) {
+			scaler->wait();
+			frames.push();
+			scaling = false;
+		}
+
+		if(game_boy.is_frame_ready()) {
+			const byte *pixels = game_boy.get_framebuffer();
+			capture_video(pixels);
+			Frame *frame = frames.back();
+			if(!game_boy.frame_changed()) {
+				// Same picture, the screen already shows it
+			} else if(frame && scaler) {
+				scaler->submit(pixels, GameBoy::WIDTH * 4, GameBoy::WIDTH,
+					GameBoy::HEIGHT, frame->pixels, frame_width * 4);
+				scaling = true;
+			} else if(frame) {
+				memcpy(frame->pixels, pixels, GameBoy::WIDTH * GameBoy::HEIGHT * 3);
+				frames.push();
+			} else {
+				dropped_frames++; // render thread is too slow
+			}
+		} else {
+			capture_video(0);
+		}
+
+		if(sound) {
+			queue_audio();
+			wait_audio();
+		} else {
+			capture_audio();
+			wait_timer(before);
+		}
+	}
+	if(scaling) {
+		scaler->wait();
+	}
+	return 0;
+}
+
+bool init_audio() {
+	SDL_AudioSpec desired;
+	SDL_AudioSpec obtained;
+	memset(&desired, 0, sizeof(desired));
+	desired.freq = AUDIO_RATE;
+	desired.format = AUDIO_S16SYS;
+	desired.channels = 2;
+	desired.samples = AUDIO_BUFFER;
+	desired.callback = audio_callback;
+	if(SDL_OpenAudio(&desired, &obtained) < 0 || obtained.format != AUDIO_S16SYS
+		|| obtained.channels != 2) {
+		std::cerr << "Unable to open audio, running without sound: " << SDL_GetError() << std::endl;
+		return false;
+	}
+	game_boy.set_sample_rate(obtained.freq);
+	SDL_PauseAudio(0);
+	return true;
+}
+
+// SDL audio thread: plays the queued samples, silence if there are not enough
+void audio_callback(void *data, Uint8 *stream, int len) {
+	short *out = reinterpret_cast<short *>(stream);
+	const size_t count = len / sizeof(short);
+	const size_t read = audio_samples.pop(out, count);
+	if(read < count) {
+		memset(out + read, 0, (count - read) * sizeof(short));
+		audio_underruns++;
+	}
+}
+
+// Queue the samples of the frame and set the rate for the next one from
+// the queue level: more samples below AUDIO_LATENCY, less above
+void queue_audio() {
+	static short samples[4096 * 2];
+	const int count = game_boy.read_samples(samples, 4096);
+	if(audio_samples.push(samples, count * 2) < static_cast<size_t>(count * 2)) {
+		audio_overflows++;
+	}
+	capture.write_frame(samples, count);
+
+	const double level = audio_samples.size() / (2.0 * AUDIO_LATENCY);
+	game_boy.set_rate_ratio(1 + MAX_RATE_DELTA * (1 - level));
+}
+
+// Hold the emulation while the audio thread has more than AUDIO_LATENCY samples to play
+void wait_audio() {
+	while(running && audio_samples.size() > AUDIO_LATENCY * 2) {
+		SDL_Delay(1);
+	}
+}
+
+// Without sound: adjust 60 fps
+// Bacause 1000/60 = 16.6666
+// I need to adjust to render 60 frames in one second
+// so I do (40 * 17) + (20 * 16) = 1000
+void wait_timer(const unsigned int before) {
+	static const float MILI_FPS = (1000.0 / GameBoy::FPS);
+	static const unsigned int FRAME_ADJUST = 40;
+	static unsigned int frame_count = 0;
+	const unsigned int after = SDL_GetTicks();
+	float time_to_sleep;
+
+	if(frame_count < FRAME_ADJUST) {
+		time_to_sleep = round(MILI_FPS) - (after - before);
+	} else {
+		time_to_sleep = static_cast<unsigned int>(MILI_FPS) - (after - before);
+	}
+	frame_count = (frame_count + 1) % GameBoy::FPS;
+
+	if(time_to_sleep > 0 && time_to_sleep < MILI_FPS) {
+		SDL_Delay(time_to_sleep);
+	}
+}
+
+bool init_capture() {
+	if(audio_out) {
+		const size_t length = strlen(audio_out);
+		const int format = length > 4 && strcmp(audio_out + length - 4, ".raw") == 0 ?
+			AUDIO_FILE_RAW : AUDIO_FILE_WAV;
+		if(!capture.open(audio_out, format, game_boy.get_sample_rate())) {
+			std::cerr << "Unable to open " << audio_out << std::endl;
+			return false;
+		}
+	}
+	if(audio_hash && !capture.open_hashes(audio_hash)) {
+		std::cerr << "Unable to open " << audio_hash << std::endl;
+		return false;
+	}
+	if(video_out) {
+		const size_t length = strlen(video_out);
+		const int format = length > 4 && strcmp(video_out + length - 4, ".yuv") == 0 ?
+			VIDEO_FILE_RAW : VIDEO_FILE_Y4M;
+		if(!video.open(video_out, format, GameBoy::WIDTH, GameBoy::HEIGHT)) {
+			std::cerr << "Unable to open " << video_out << std::endl;
+			return false;
 		}
 	}
+	return true;
+}
+
+// Without a sound device the samples of the frame only go to the capture
+void capture_audio() {
+	static short samples[4096 * 2];
+	capture.write_frame(samples, game_boy.read_samples(samples, 4096));
+}
+
+// Every emulated frame is a video frame, the last one is repeated when
+// there is no new picture (skipped frame, LCD off) or it did not change
+void capture_video(const byte *pixels) {
+	if(pixels && game_boy.frame_changed()) {
+		video.write_frame(pixels, frame_bytes == 4 ? GameBoy::FORMAT_RGBA32 : GameBoy::FORMAT_RGB24,
+			GameBoy::WIDTH * frame_bytes);
+	} else {
+		video.repeat_frame();
+	}
+}
+
+// No window and no sound device: run the frames and capture them
+void headless_loop() {
+	for(int i = 0; i < headless_frames; i++) {
+		game_boy.frame();
+		capture_audio();
+		capture_video(game_boy.is_frame_ready() ? game_boy.get_framebuffer() : 0);
+	}
+	capture.close();
+	video.close();
 }
 
 inline void show_copyright() {
@@ -329,6 +859,16 @@ inline void show_usage() {
 		<< "  -s [color-scheme] scheme \tselect color scheme (0-8)" << std::endl
 		<< "  -v [version] \t\t\tprint version" << std::endl
 		<< "  -m [magnification] s \t\tscreen magnification (0-4)" << std::endl
+		<< "  -r [renderer] name \t\tpixels or texture (default)" << std::endl
+		<< "  -f [filter] name \t\tnearest, scale2x, scale3x or blend2x" << std::endl
+		<< "  -n [frameskip] n \t\tdraw one frame out of n + 1, or auto" << std::endl
+		<< "  -p [ppu] name \t\tscanline (default) or fifo (mid line effects)" << std::endl
+		<< "  -a [audio] on|off \t\tsound, paces the emulation (default on)" << std::endl
+		<< "  -o [audio-out] file \t\trecord the sound to a .wav or .raw file (- for stdout)" << std::endl
+		<< "  -H [audio-hash] file \t\twrite the hash of the sound of every frame" << std::endl
+		<< "  -V [video-out] file \t\trecord the frames to a .y4m or .yuv file (- for stdout)" << std::endl
+		<< "  -x [headless] frames \t\trun that many frames without window and sound device" << std::endl
+		<< "  -u [upload-log] frames \tprint the average upload time of every that many frames" << std::endl
 		<< "  -h [help]\t\t\tshow this help" << std::endl
 		<< "  -c [copyright]\t\tcopyright information" << std::endl << std::endl
 		<< "Cross Platform Nintendo(R) GameBoy(R) (DMG, MGB, MGL) emulator written in C++ with SDL/OpenGL." << std::endl;
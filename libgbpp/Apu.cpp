@@ -0,0 +1,659 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include <cmath>
+#include <cstring>
+#include "Apu.h"
+
+namespace gbpp {
+
+	// Bits always set when reading 0xFF10-0xFF2F (write only and unused bits)
+	static const byte read_masks[0x20] = {
+		0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+		0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR21-NR24
+		0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+		0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR41-NR44
+		0x00, 0x00, 0x70,             // NR50-NR52
+		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+	};
+
+	// 12.5%, 25%, 50% and 75% duty cycles, one bit per step
+	static const byte duty_patterns[4] = { 0x01, 0x81, 0x87, 0x7E };
+
+	// NR32 volume code: mute, 100%, 50%, 25%
+	static const int wave_shifts[4] = { 4, 0, 1, 2 };
+
+	short Apu::blip_kernel[BLIP_PHASES][BLIP_WIDTH];
+
+	Apu::Apu() : sample_rate(DEFAULT_SAMPLE_RATE),
+			factor((1ULL << 32) / (Cpu::CLOCK_SPEED / INTERNAL_RATE)), overflows(0), output_enabled(true) {
+		build_kernel();
+		set_sample_rate(DEFAULT_SAMPLE_RATE);
+		reset();
+	}
+
+	// Band limited impulses (Blackman windowed sinc, cutoff at 45% of
+	// INTERNAL_RATE), one for every phase of a sample, the taps of each phase
+	// sum to 1 << BLIP_DELTA_BITS so the integrated steps have no error.
+	void Apu::build_kernel() {
+		const double pi = 3.14159265358979323846;
+		const double cutoff = 0.45;
+		const int half = BLIP_WIDTH / 2;
+		for(int phase = 0; phase < BLIP_PHASES; phase++) {
+			double taps[BLIP_WIDTH];
+			double sum = 0;
+			for(int i = 0; i < BLIP_WIDTH; i++) {
+				const double x = i - half - static_cast<double>(phase) / BLIP_PHASES;
+				const double sinc = x == 0 ? 1 : sin(2 * pi * cutoff * x) / (2 * pi * cutoff * x);
+				const double window = 0.42 + 0.5 * cos(pi * x / half) + 0.08 * cos(2 * pi * x / half);
+				taps[i] = x <= -half ? 0 : sinc * window;
+				sum += taps[i];
+			}
+			int total = 0;
+			for(int i = 0; i < BLIP_WIDTH; i++) {
+				blip_kernel[phase][i] = static_cast<short>(floor(taps[i] * (1 << BLIP_DELTA_BITS) / sum + 0.5));
+				total += blip_kernel[phase][i];
+			}
+			blip_kernel[phase][half] += (1 << BLIP_DELTA_BITS) - total;
+		}
+	}
+
+	// State after the bios
+	void Apu::reset() {
+		memset(channels, 0, sizeof(channels));
+		memset(registers, 0, sizeof(registers));
+		memset(wave, 0, sizeof(wave));
+		sweep_shadow = 0;
+		sweep_timer = 0;
+		sweep_enabled = false;
+		lfsr = 0x7FFF;
+		powered = true;
+
+		time = cpu.get_cpu_time();
+		sequencer_time = time + SEQUENCER_PERIOD;
+		sequencer_step = 0;
+
+		reg(Memory::NR_10) = 0x80;
+		reg(Memory::NR_11) = 0xBF;
+		reg(Memory::NR_12) = 0xF3;
+		reg(Memory::NR_14) = 0xBF;
+		reg(Memory::NR_21) = 0x3F;
+		reg(Memory::NR_22) = 0x00;
+		reg(Memory::NR_24) = 0xBF;
+		reg(Memory::NR_30) = 0x7F;
+		reg(Memory::NR_31) = 0xFF;
+		reg(Memory::NR_32) = 0x9F;
+		reg(Memory::NR_34) = 0xBF;
+		reg(Memory::NR_41) = 0xFF;
+		reg(Memory::NR_42) = 0x00;
+		reg(Memory::NR_43) = 0x00;
+		reg(Memory::NR_44) = 0xBF;
+		reg(Memory::NR_50) = 0x77;
+		reg(Memory::NR_51) = 0xF3;
+
+		// The boot sound is over, channel 1 is still on at volume 0
+		channels[0].enabled = true;
+		channels[0].dac = true;
+		for(int ch = 0; ch < CHANNELS; ch++) {
+			update_period(ch);
+		}
+		clear_samples();
+	}
+
+	/**
+	 * Output rate of read_samples(), in Hz (8000-192000). The samples not
+	 * read yet are dropped.
+	 */
+	void Apu::set_sample_rate(const int rate) {
+		sample_rate = rate < 8000 ? 8000 : (rate > 192000 ? 192000 : rate);
+		resampler.set_rates(INTERNAL_RATE, sample_rate);
+		clear_samples();
+	}
+
+	int Apu::get_sample_rate() const {
+		return sample_rate;
+	}
+
+	/**
+	 * Dynamic rate control: make ratio times the samples of the sample rate
+	 * (within 0.9-1.1), to follow the consumer clock. The samples already
+	 * made are kept, there is no click.
+	 */
+	void Apu::set_rate_ratio(const double ratio) {
+		resampler.set_ratio(ratio < 0.9 ? 0.9 : (ratio > 1.1 ? 1.1 : ratio));
+	}
+
+	inline byte &Apu::reg(const word addr) {
+		return registers[addr - FIRST_REGISTER];
+	}
+
+	// Called by Memory for 0xFF10-0xFF3F
+	byte Apu::read_register(const word addr) {
+		if(addr >= WAVE_RAM) {
+			return reg(addr);
+		}
+		if(addr == Memory::NR_52) {
+			// Length counters may have turned channels off since the last access
+			run_until(cpu.get_cpu_time());
+			byte status = read_masks[addr - FIRST_REGISTER];
+			if(powered) {
+				set_bit(status, 7);
+			}
+			for(int ch = 0; ch < CHANNELS; ch++) {
+				if(channels[ch].enabled) {
+					set_bit(status, ch);
+				}
+			}
+			return status;
+		}
+		return reg(addr) | read_masks[addr - FIRST_REGISTER];
+	}
+
+	// Called by Memory for 0xFF10-0xFF3F, the channels catch up with the CPU first
+	void Apu::write_register(const word addr, const byte data) {
+		run_until(cpu.get_cpu_time());
+
+		if(addr >= WAVE_RAM) {
+			reg(addr) = data;
+			wave[(addr - WAVE_RAM) * 2] = data >> 4;
+			wave[(addr - WAVE_RAM) * 2 + 1] = data & 0x0F;
+			return;
+		}
+
+		if(addr == Memory::NR_52) {
+			const bool on = test_bit(data, 7);
+			if(powered && !on) {
+				// Power off clears every register and stops the channels
+				memset(registers, 0, WAVE_RAM - FIRST_REGISTER);
+				for(int ch = 0; ch < CHANNELS; ch++) {
+					channels[ch].enabled = false;
+					channels[ch].dac = false;
+					channels[ch].length_enabled = false;
+					channels[ch].envelope.volume = 0;
+				}
+				update_mixer(time);
+			} else if(!powered && on) {
+				sequencer_step = 0;
+			}
+			powered = on;
+			return;
+		}
+
+		// Registers are read only while the power is off, but the DMG
+		// still takes the lengths of NRx1 (not the duty bits)
+		if(!powered) {
+			if(addr < Memory::NR_50 && (addr - FIRST_REGISTER) % 5 == 1) {
+				const int ch = (addr - FIRST_REGISTER) / 5;
+				reg(addr) = ch == 0 || ch == 1 ? data & 0x3F : data;
+				channels[ch].length = ch == 2 ? 256 - data : 64 - (data & 0x3F);
+			}
+			return;
+		}
+		reg(addr) = data;
+
+		if(addr == Memory::NR_50 || addr == Memory::NR_51) {
+			update_mixer(time);
+			return;
+		}
+		if(addr > Memory::NR_52) {
+			return;
+		}
+
+		const int ch = (addr - FIRST_REGISTER) / 5;
+		Channel &channel = channels[ch];
+		switch((addr - FIRST_REGISTER) % 5) {
+		case 0: // NR10 sweep, NR30 DAC
+			if(ch == 2) {
+				channel.dac = test_bit(data, 7);
+				if(!channel.dac) {
+					channel.enabled = false;
+				}
+			}
+			break;
+		case 1: // length
+			channel.length = ch == 2 ? 256 - data : 64 - (data & 0x3F);
+			break;
+		case 2: // envelope, NR32 volume
+			if(ch != 2) {
+				channel.dac = (data & 0xF8) != 0;
+				if(!channel.dac) {
+					channel.enabled = false;
+				}
+			}
+			break;
+		case 3: // frequency, NR43 noise clock
+			if(ch != 3) {
+				channel.frequency = (channel.frequency & 0x700) | data;
+			}
+			update_period(ch);
+			break;
+		case 4:
+			channel.length_enabled = test_bit(data, 6);
+			if(ch != 3) {
+				channel.frequency = (channel.frequency & 0xFF) | ((data & 0x07) << 8);
+				update_period(ch);
+			}
+			if(test_bit(data, 7)) {
+				trigger(ch);
+			}
+			break;
+		}
+		update_output(ch, time);
+	}
+
+	// Cycles of a waveform step, 0 if the channel is not clocked
+	void Apu::update_period(const int ch) {
+		Channel &channel = channels[ch];
+		if(ch == 3) {
+			const byte nr43 = reg(Memory::NR_43);
+			const int divisor = (nr43 & 0x07) ? (nr43 & 0x07) * 16 : 8;
+			channel.period = (nr43 >> 4) < 14 ? divisor << (nr43 >> 4) : 0;
+		} else {
+			channel.period = (2048 - channel.frequency) * (ch == 2 ? 2 : 4);
+		}
+	}
+
+	void Apu::trigger(const int ch) {
+		Channel &channel = channels[ch];
+
+		channel.enabled = channel.dac;
+		if(channel.length == 0) {
+			channel.length = ch == 2 ? 256 : 64;
+		}
+		channel.next_time = time + channel.period;
+
+		const byte nr2 = reg(FIRST_REGISTER + ch * 5 + 2);
+		channel.envelope.volume = nr2 >> 4;
+		channel.envelope.add = test_bit(nr2, 3);
+		channel.envelope.period = nr2 & 0x07;
+		channel.envelope.timer = channel.envelope.period;
+
+		if(ch == 2) {
+			channel.position = 0;
+		} else if(ch == 3) {
+			lfsr = 0x7FFF;
+		} else if(ch == 0) {
+			const byte nr10 = reg(Memory::NR_10);
+			const int period = (nr10 >> 4) & 0x07;
+			sweep_shadow = channel.frequency;
+			sweep_timer = period ? period : 8;
+			sweep_enabled = period != 0 || (nr10 & 0x07) != 0;
+			if(nr10 & 0x07) {
+				sweep_frequency();
+			}
+		}
+	}
+
+	// Next frequency of the sweep, channel 1 stops if it overflows
+	int Apu::sweep_frequency() {
+		const byte nr10 = reg(Memory::NR_10);
+		int frequency = sweep_shadow >> (nr10 & 0x07);
+		frequency = test_bit(nr10, 3) ? sweep_shadow - frequency : sweep_shadow + frequency;
+		if(frequency > 2047) {
+			channels[0].enabled = false;
+		}
+		return frequency;
+	}
+
+	void Apu::clock_sweep() {
+		if(--sweep_timer > 0) {
+			return;
+		}
+		const byte nr10 = reg(Memory::NR_10);
+		const int period = (nr10 >> 4) & 0x07;
+		sweep_timer = period ? period : 8;
+		if(!sweep_enabled || period == 0) {
+			return;
+		}
+		const int frequency = sweep_frequency();
+		if(frequency <= 2047 && (nr10 & 0x07)) {
+			sweep_shadow = frequency;
+			channels[0].frequency = frequency;
+			reg(Memory::NR_10 + 3) = frequency & 0xFF;
+			reg(Memory::NR_14) = (reg(Memory::NR_14) & 0xF8) | (frequency >> 8);
+			update_period(0);
+			sweep_frequency();
+		}
+	}
+
+	void Apu::clock_length(Channel &channel) {
+		if(channel.length_enabled && channel.length > 0 && --channel.length == 0) {
+			channel.enabled = false;
+		}
+	}
+
+	void Apu::clock_envelope(Channel &channel) {
+		Envelope &envelope = channel.envelope;
+		if(envelope.period == 0 || --envelope.timer > 0) {
+			return;
+		}
+		envelope.timer = envelope.period;
+		if(envelope.add && envelope.volume < 15) {
+			envelope.volume++;
+		} else if(!envelope.add && envelope.volume > 0) {
+			envelope.volume--;
+		}
+	}
+
+	// 512 Hz: length at 256 Hz, sweep at 128 Hz, envelope at 64 Hz
+	void Apu::clock_sequencer() {
+		if(powered) {
+			if(sequencer_step % 2 == 0) {
+				for(int ch = 0; ch < CHANNELS; ch++) {
+					clock_length(channels[ch]);
+				}
+			}
+			if(sequencer_step == 2 || sequencer_step == 6) {
+				clock_sweep();
+			}
+			if(sequencer_step == 7) {
+				clock_envelope(channels[0]);
+				clock_envelope(channels[1]);
+				clock_envelope(channels[3]);
+			}
+			update_mixer(time);
+		}
+		sequencer_step = (sequencer_step + 1) % 8;
+	}
+
+	// Clock the channels and the frame sequencer up to end (CPU time)
+	void Apu::run_until(const int end) {
+		while(time < end) {
+			const int next = sequencer_time < end ? sequencer_time : end;
+			for(int ch = 0; ch < CHANNELS; ch++) {
+				run_channel(ch, next);
+			}
+			time = next;
+			if(time == sequencer_time) {
+				clock_sequencer();
+				sequencer_time += SEQUENCER_PERIOD;
+			}
+		}
+	}
+
+	// Waveform steps of a channel before end, each one may change its output
+	void Apu::run_channel(const int ch, const int end) {
+		Channel &channel = channels[ch];
+		if(channel.period == 0 || channel.next_time >= end) {
+			return;
+		}
+
+		// Silent: nothing to add to the buffers, keep the phase
+		if(!channel.enabled || (ch != 2 && channel.envelope.volume == 0)) {
+			const int steps = (end - channel.next_time + channel.period - 1) / channel.period;
+			channel.position = (channel.position + steps) & (ch == 2 ? 31 : 7);
+			channel.next_time += steps * channel.period;
+			return;
+		}
+
+		const byte nr43 = reg(Memory::NR_43);
+		while(channel.next_time < end) {
+			if(ch == 3) {
+				const int bit = (lfsr ^ (lfsr >> 1)) & 1;
+				lfsr = (lfsr >> 1) | (bit << 14);
+				if(test_bit(nr43, 3)) {
+					lfsr = (lfsr & ~0x40) | (bit << 6);
+				}
+			} else {
+				channel.position = (channel.position + 1) & (ch == 2 ? 31 : 7);
+			}
+			update_output(ch, channel.next_time);
+			channel.next_time += channel.period;
+		}
+	}
+
+	// Put the current output of a channel (0-15, through NR50/NR51) in the
+	// buffers at time t
+	void Apu::update_output(const int ch, const int t) {
+		Channel &channel = channels[ch];
+		int value = 0;
+		if(channel.enabled) {
+			switch(ch) {
+			case 0:
+			case 1:
+				value = (duty_patterns[registers[ch * 5 + 1] >> 6] >> channel.position) & 1
+					? channel.envelope.volume : 0;
+				break;
+			case 2:
+				value = wave[channel.position] >> wave_shifts[(reg(Memory::NR_32) >> 5) & 0x03];
+				break;
+			case 3:
+				value = (lfsr & 1) ? 0 : channel.envelope.volume;
+				break;
+			}
+		}
+
+		const byte nr50 = reg(Memory::NR_50);
+		const byte nr51 = reg(Memory::NR_51);
+		const int left = test_bit(nr51, (ch + 4)) ? value * (((nr50 >> 4) & 0x07) + 1) * VOLUME_UNIT : 0;
+		const int right = test_bit(nr51, ch) ? value * ((nr50 & 0x07) + 1) * VOLUME_UNIT : 0;
+		if(left != channel.left) {
+			add_delta(0, t, left - channel.left);
+			channel.left = left;
+		}
+		if(right != channel.right) {
+			add_delta(1, t, right - channel.right);
+			channel.right = right;
+		}
+	}
+
+	void Apu::update_mixer(const int t) {
+		for(int ch = 0; ch < CHANNELS; ch++) {
+			update_output(ch, t);
+		}
+	}
+
+	// Add a band limited step of delta at CPU time t of the frame
+	void Apu::add_delta(const int side, const int t, const int delta) {
+		const unsigned long long fixed = offset + static_cast<unsigned long long>(t) * factor;
+		int position = available + static_cast<int>(fixed >> 32);
+		// Never in a frame, a step past the buffer is put at its end so
+		// the level stays right
+		if(position > BLIP_SIZE) {
+			position = BLIP_SIZE;
+		}
+		const short *kernel = blip_kernel[(fixed >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+		int *out = buffers[side] + position;
+		for(int i = 0; i < BLIP_WIDTH; i++) {
+			out[i] += kernel[i] * delta;
+		}
+	}
+
+	/**
+	 * Called at the end of every frame of cycles CPU cycles: the samples of
+	 * the frame go to the resampler and the times start again from 0.
+	 */
+	void Apu::end_frame(const int cycles) {
+		run_until(cycles);
+
+		const unsigned long long fixed = offset + static_cast<unsigned long long>(cycles) * factor;
+		available += static_cast<int>(fixed >> 32);
+		offset = fixed & 0xFFFFFFFFULL;
+
+		// The CPU may be a few cycles in the next frame already
+		time -= cycles;
+		sequencer_time -= cycles;
+		for(int ch = 0; ch < CHANNELS; ch++) {
+			channels[ch].next_time -= cycles;
+			if(channels[ch].next_time < time) {
+				channels[ch].next_time = time;
+			}
+		}
+
+		if(output_enabled) {
+			resample();
+		} else {
+			remove_samples(available);
+		}
+	}
+
+	// Integrate the delta buffers (with the high pass) and give the
+	// samples to the resampler
+	void Apu::resample() {
+		for(int side = 0; side < 2; side++) {
+			const int *in = buffers[side];
+			float *out = mixed[side];
+			int sum = integrators[side];
+			for(int i = 0; i < available; i++) {
+				const int sample = sum >> BLIP_DELTA_BITS;
+				sum += in[i];
+				out[i] = static_cast<float>(sample);
+				sum -= sample << (BLIP_DELTA_BITS - BLIP_BASS_SHIFT);
+			}
+			integrators[side] = sum;
+		}
+		if(!resampler.write(mixed[0], mixed[1], available)) {
+			overflows++;
+		}
+		remove_samples(available);
+	}
+
+	// Stereo samples (frames) that read_samples() can return
+	int Apu::samples_available() const {
+		return resampler.available();
+	}
+
+	/**
+	 * Read up to count stereo samples, 16 bit left and right interleaved,
+	 * returns how many were read. If they are not read the oldest ones
+	 * are dropped after a few frames.
+	 */
+	int Apu::read_samples(short *out, const int count) {
+		return resampler.read(out, count);
+	}
+
+	// Times the samples were not read in time and got dropped
+	unsigned int Apu::get_overflows() const {
+		return overflows;
+	}
+
+	/**
+	 * Without output (no reader, like a bot or a video only capture) the
+	 * channels run but no sample is made, and nothing overflows. It
+	 * starts again from silence.
+	 */
+	void Apu::set_output_enabled(const bool enabled) {
+		if(enabled != output_enabled) {
+			output_enabled = enabled;
+			clear_samples();
+		}
+	}
+
+	bool Apu::is_output_enabled() const {
+		return output_enabled;
+	}
+
+	void Apu::remove_samples(const int count) {
+		if(count == 0) {
+			return;
+		}
+		const int remaining = BLIP_SIZE + BLIP_WIDTH - count;
+		for(int side = 0; side < 2; side++) {
+			memmove(buffers[side], buffers[side] + count, remaining * sizeof(int));
+			memset(buffers[side] + remaining, 0, count * sizeof(int));
+		}
+		available -= count;
+	}
+
+	void Apu::clear_samples() {
+		memset(buffers, 0, sizeof(buffers));
+		integrators[0] = 0;
+		integrators[1] = 0;
+		available = 0;
+		offset = 0;
+		resampler.clear();
+	}
+
+	// The channels and the registers, the samples made so far are not saved
+	void Apu::save_state(StateWriter &state) const {
+		for(int ch = 0; ch < CHANNELS; ch++) {
+			const Channel &channel = channels[ch];
+			state.put(channel.enabled);
+			state.put(channel.dac);
+			state.put(channel.length);
+			state.put(channel.length_enabled);
+			state.put(channel.frequency);
+			state.put(channel.period);
+			state.put(channel.next_time);
+			state.put(channel.position);
+			state.put(channel.envelope.volume);
+			state.put(channel.envelope.period);
+			state.put(channel.envelope.timer);
+			state.put(channel.envelope.add);
+			state.put(channel.left);
+			state.put(channel.right);
+		}
+		state.put(sweep_shadow);
+		state.put(sweep_timer);
+		state.put(sweep_enabled);
+		state.put(lfsr);
+		state.put(wave);
+		state.put(registers);
+		state.put(powered);
+		state.put(time);
+		state.put(sequencer_time);
+		state.put(sequencer_step);
+	}
+
+	/**
+	 * Times are relative to the frame and may not be negative (they place
+	 * the steps in the buffers), the output restarts from silence.
+	 */
+	void Apu::load_state(StateReader &state) {
+		static const int MAX_TIME = 1 << 24;
+		static const int MAX_PERIOD = 112 << 13; // noise, NR43 = 0xD7
+		static const int MAX_AMPLITUDE = 15 * 8 * VOLUME_UNIT;
+		for(int ch = 0; ch < CHANNELS; ch++) {
+			Channel &channel = channels[ch];
+			state.get(channel.enabled);
+			state.get(channel.dac);
+			state.get(channel.length, 0, 256);
+			state.get(channel.length_enabled);
+			state.get(channel.frequency, 0, 2047);
+			state.get(channel.period, 0, MAX_PERIOD);
+			state.get(channel.next_time, 0, MAX_TIME + MAX_PERIOD);
+			state.get(channel.position, 0, ch == 2 ? 31 : 7);
+			state.get(channel.envelope.volume, 0, 15);
+			state.get(channel.envelope.period, 0, 7);
+			state.get(channel.envelope.timer, 0, 7);
+			state.get(channel.envelope.add);
+			state.get(channel.left, 0, MAX_AMPLITUDE);
+			state.get(channel.right, 0, MAX_AMPLITUDE);
+		}
+		state.get(sweep_shadow, 0, 2047);
+		state.get(sweep_timer, 0, 8);
+		state.get(sweep_enabled);
+		state.get(lfsr, 0, 0x7FFF);
+		for(int i = 0; i < 32; i++) {
+			state.get(wave[i], 0, 15);
+		}
+		state.get(registers);
+		state.get(powered);
+		state.get(time, 0, MAX_TIME);
+		state.get(sequencer_time, 0, MAX_TIME + SEQUENCER_PERIOD);
+		state.get(sequencer_step, 0, 7);
+		if(state.is_applying()) {
+			clear_samples();
+		}
+	}
+
+	Apu& Apu::get_instance() {
+		static Apu inst;
+		return inst;
+	}
+}
@@ -0,0 +1,156 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _APU_H_
+#define _APU_H_
+
+#include "types.h"
+#include "util.h"
+#include "Components.h"
+#include "State.h"
+#include "Resampler.h"
+
+namespace gbpp {
+
+	/**
+	 * Sound: two pulse channels (the first one with sweep), the wave channel
+	 * and the noise channel, mixed by NR50/NR51.
+	 *
+	 * Nothing runs in the CPU loop. The channels are clocked up to the CPU
+	 * time when a sound register is accessed and at the end of the frame,
+	 * every change of a channel output is added as a band limited step to
+	 * a left and a right delta buffer at INTERNAL_RATE. At the end of the
+	 * frame the Resampler takes them to the output rate.
+	 */
+	class Apu {
+	public:
+		static const int FIRST_REGISTER = 0xFF10;
+		static const int LAST_REGISTER  = 0xFF3F;
+		static const int WAVE_RAM       = 0xFF30;
+
+		static const int DEFAULT_SAMPLE_RATE = 44100;
+		static const int INTERNAL_RATE = 131072; // CPU clock / 32
+
+		void reset();
+		void set_sample_rate(const int rate);
+		int get_sample_rate() const;
+		void set_rate_ratio(const double ratio);
+
+		byte read_register(const word addr);
+		void write_register(const word addr, const byte data);
+
+		void end_frame(const int cycles);
+		int samples_available() const;
+		int read_samples(short *out, const int count);
+		unsigned int get_overflows() const;
+		void clear_samples();
+		void set_output_enabled(const bool enabled);
+		bool is_output_enabled() const;
+
+		void save_state(StateWriter &state) const;
+		void load_state(StateReader &state);
+
+		static Apu& get_instance();
+
+	private:
+		Apu();
+
+		static const int CHANNELS = 4;
+		static const int SEQUENCER_PERIOD = 8192; // 512 Hz
+
+		// Band limited step synthesis: a step at a fractional sample
+		// position is the sum of BLIP_WIDTH impulses of the phase.
+		static const int BLIP_PHASE_BITS = 6;
+		static const int BLIP_PHASES = 1 << BLIP_PHASE_BITS;
+		static const int BLIP_WIDTH = 16;
+		static const int BLIP_DELTA_BITS = 15;
+		static const int BLIP_BASS_SHIFT = 9; // high pass, removes the DAC offset
+		static const int BLIP_SIZE = 8192;    // samples of a buffer, a double speed frame is 4389
+		static const int VOLUME_UNIT = 48;    // one step of a channel at full volume
+
+		struct Envelope {
+			int volume;
+			int period;
+			int timer;
+			bool add;
+		};
+
+		struct Channel {
+			bool enabled;
+			bool dac;
+			int length;
+			bool length_enabled;
+			int frequency;
+			int period;        // cycles of a waveform step
+			int next_time;     // of the next waveform step
+			int position;      // in the waveform (duty step, wave sample)
+			Envelope envelope;
+			int left;          // amplitude in the buffers
+			int right;
+		};
+
+		Channel channels[CHANNELS];
+
+		// Channel 1 frequency sweep
+		int sweep_shadow;
+		int sweep_timer;
+		bool sweep_enabled;
+
+		word lfsr;
+		byte wave[32];
+
+		byte registers[LAST_REGISTER - FIRST_REGISTER + 1];
+		bool powered;
+
+		int time;           // channels are clocked up to here (CPU time)
+		int sequencer_time; // next frame sequencer step
+		int sequencer_step;
+
+		int sample_rate;
+		unsigned long long factor; // samples per cycle, 32 bit fraction
+		unsigned long long offset; // fraction of the first free sample
+		int available;
+		int buffers[2][BLIP_SIZE + BLIP_WIDTH];
+		int integrators[2];
+		float mixed[2][BLIP_SIZE];
+		Resampler resampler;
+		unsigned int overflows;
+		bool output_enabled; // false: nobody reads the samples, they are not made
+
+		static short blip_kernel[BLIP_PHASES][BLIP_WIDTH];
+		static void build_kernel();
+
+		byte &reg(const word addr);
+		void run_until(const int end);
+		void run_channel(const int ch, const int end);
+		void clock_sequencer();
+		void clock_length(Channel &channel);
+		void clock_envelope(Channel &channel);
+		void clock_sweep();
+		int sweep_frequency();
+		void trigger(const int ch);
+		void update_period(const int ch);
+		void update_output(const int ch, const int t);
+		void update_mixer(const int t);
+		void add_delta(const int side, const int t, const int delta);
+		void remove_samples(const int count);
+		void resample();
+	};
+}
+
+#endif /* _APU_H_ */
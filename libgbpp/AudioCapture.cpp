@@ -0,0 +1,137 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "AudioCapture.h"
+
+namespace gbpp {
+
+	static const int WAV_HEADER = 44;
+	static const unsigned int WAV_STREAM_SIZE = 0xFFFFFFFF; // length not known
+
+	static inline void put_le16(byte *out, const unsigned int value) {
+		out[0] = value & 0xFF;
+		out[1] = (value >> 8) & 0xFF;
+	}
+
+	static inline void put_le32(byte *out, const unsigned int value) {
+		put_le16(out, value & 0xFFFF);
+		put_le16(out + 2, value >> 16);
+	}
+
+	unsigned long long hash_samples(const short *samples, const int count) {
+		unsigned long long hash = 0xCBF29CE484222325ULL;
+		for(int i = 0; i < count; i++) {
+			const unsigned int sample = static_cast<unsigned short>(samples[i]);
+			hash = (hash ^ (sample & 0xFF)) * 0x100000001B3ULL;
+			hash = (hash ^ (sample >> 8)) * 0x100000001B3ULL;
+		}
+		return hash;
+	}
+
+	AudioCapture::AudioCapture() : format(AUDIO_FILE_WAV), rate(0), frames(0), data_size(0) {
+	}
+
+	AudioCapture::~AudioCapture() {
+		close();
+	}
+
+	/**
+	 * Samples at rate Hz to path ("-" for the standard output). When the
+	 * WAV file can not be seeked (a pipe) the sizes in the header stay
+	 * 0xFFFFFFFF, which the usual tools read as "until the end".
+	 */
+	bool AudioCapture::open(const string path, const int _format, const int _rate) {
+		format = _format;
+		rate = _rate;
+		data_size = 0;
+		if(!samples_file.open(path)) {
+			return false;
+		}
+		if(format == AUDIO_FILE_WAV) {
+			byte header[WAV_HEADER];
+			write_header(header, WAV_STREAM_SIZE);
+			samples_file.write(header, WAV_HEADER);
+		}
+		return true;
+	}
+
+	// One line per frame: frame number, stereo samples and their hash
+	bool AudioCapture::open_hashes(const string path) {
+		frames = 0;
+		return hashes_file.open(path);
+	}
+
+	// count stereo samples of the frame (left and right interleaved)
+	void AudioCapture::write_frame(const short *samples, const int count) {
+		if(samples_file.is_open() && count > 0) {
+			bytes.resize(count * 4);
+			for(int i = 0; i < count * 2; i++) {
+				put_le16(&bytes[i * 2], static_cast<unsigned short>(samples[i]));
+			}
+			samples_file.write(&bytes[0], bytes.size());
+			data_size += bytes.size();
+		}
+		if(hashes_file.is_open()) {
+			char line[64];
+			const int size = snprintf(line, sizeof(line), "%u %d %016llx\n", frames, count,
+				hash_samples(samples, count * 2));
+			hashes_file.write(line, size);
+		}
+		frames++;
+	}
+
+	// Flush both files and give the WAV header its real sizes
+	void AudioCapture::close() {
+		const bool wav = samples_file.is_open() && format == AUDIO_FILE_WAV;
+		samples_file.close();
+		hashes_file.close();
+		if(wav && samples_file.is_seekable()) {
+			byte header[WAV_HEADER];
+			write_header(header, data_size + WAV_HEADER - 8 > WAV_STREAM_SIZE ?
+				WAV_STREAM_SIZE : static_cast<unsigned int>(data_size));
+			samples_file.rewrite(0, header, WAV_HEADER);
+		}
+	}
+
+	bool AudioCapture::failed() const {
+		return samples_file.failed() || hashes_file.failed();
+	}
+
+	// Times a frame had to wait for the disk
+	unsigned int AudioCapture::get_stalls() const {
+		return samples_file.get_stalls() + hashes_file.get_stalls();
+	}
+
+	// 16 bit stereo PCM, size bytes of samples
+	void AudioCapture::write_header(byte *header, const unsigned int size) const {
+		memcpy(header, "RIFF", 4);
+		put_le32(header + 4, size == WAV_STREAM_SIZE ? WAV_STREAM_SIZE : size + WAV_HEADER - 8);
+		memcpy(header + 8, "WAVEfmt ", 8);
+		put_le32(header + 16, 16);       // fmt chunk size
+		put_le16(header + 20, 1);        // PCM
+		put_le16(header + 22, 2);        // channels
+		put_le32(header + 24, rate);
+		put_le32(header + 28, rate * 4); // bytes per second
+		put_le16(header + 32, 4);        // bytes per frame
+		put_le16(header + 34, 16);       // bits per sample
+		memcpy(header + 36, "data", 4);
+		put_le32(header + 40, size);
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _AUDIO_CAPTURE_H_
+#define _AUDIO_CAPTURE_H_
+
+#include <string>
+#include <vector>
+#include "types.h"
+#include "StreamWriter.h"
+
+using std::string;
+
+namespace gbpp {
+
+	enum { AUDIO_FILE_WAV, AUDIO_FILE_RAW };
+
+	// FNV-1a of the samples (16 bit little endian), the same on every host.
+	unsigned long long hash_samples(const short *samples, const int count);
+
+	/**
+	 * Records the sound of every frame: the samples to a WAV or raw file
+	 * (16 bit little endian, stereo interleaved) and/or one line with the
+	 * hash of the samples of each frame, to compare with a golden run.
+	 * The files are written by StreamWriter worker threads.
+	 */
+	class AudioCapture {
+	public:
+		AudioCapture();
+		~AudioCapture();
+
+		bool open(const string path, const int format, const int rate);
+		bool open_hashes(const string path);
+		void write_frame(const short *samples, const int count);
+		void close();
+
+		bool failed() const;
+		unsigned int get_stalls() const;
+
+	private:
+		int format;
+		int rate;
+		unsigned int frames;
+		unsigned long long data_size; // bytes of samples written
+		std::vector<byte> bytes;
+		StreamWriter samples_file;
+		StreamWriter hashes_file;
+
+		void write_header(byte *header, const unsigned int size) const;
+
+		AudioCapture(const AudioCapture &);
+		AudioCapture &operator=(const AudioCapture &);
+	};
+}
+
+#endif /* _AUDIO_CAPTURE_H_ */
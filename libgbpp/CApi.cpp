@@ -0,0 +1,209 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include <new>
+#include <atomic>
+#include "gbpp.h"
+#include "GameBoy.h"
+
+using namespace gbpp;
+
+struct gbpp_emulator {
+	GameBoy game_boy;
+	gbpp_observation observation;
+	bool rom_loaded;
+};
+
+// The components are singletons, one emulator at a time in the process
+static std::atomic<bool> instance_exists(false);
+
+// The components outlive a handle: a new one starts from the defaults,
+// not from what the last one (or a C++ user) left
+static void reset_settings(GameBoy &game_boy) {
+	game_boy.set_framebuffer(0, GameBoy::FORMAT_RGB24, 0);
+	game_boy.set_output(GameBoy::OUTPUT_RGB);
+	game_boy.use_color_scheme(0);
+	game_boy.set_ppu(GameBoy::PPU_SCANLINE);
+	game_boy.set_frameskip(0);
+	game_boy.set_sample_rate(Apu::DEFAULT_SAMPLE_RATE);
+	game_boy.set_rate_ratio(1);
+	game_boy.set_audio_enabled(false); // no sample reading in the C API
+	game_boy.set_input(0);
+}
+
+static const gbpp_observation *observe(gbpp_emulator *gb, const GameBoy::Observation &observation) {
+	gb->observation.framebuffer = observation.framebuffer;
+	gb->observation.pitch = observation.pitch;
+	gb->observation.frame_changed = observation.frame_changed;
+	gb->observation.frames = observation.frames;
+	gb->observation.frame_cycles = observation.frame_cycles;
+	return &gb->observation;
+}
+
+int gbpp_abi_version(void) {
+	return GBPP_ABI_VERSION;
+}
+
+gbpp_emulator *gbpp_create(void) {
+	if(instance_exists.exchange(true)) {
+		return 0;
+	}
+	gbpp_emulator *gb = new (std::nothrow) gbpp_emulator();
+	if(!gb) {
+		instance_exists = false;
+		return 0;
+	}
+	try {
+		reset_settings(gb->game_boy);
+	} catch(...) {
+		delete gb;
+		instance_exists = false;
+		return 0;
+	}
+	gb->rom_loaded = false;
+	return gb;
+}
+
+void gbpp_destroy(gbpp_emulator *gb) {
+	if(gb) {
+		delete gb;
+		instance_exists = false;
+	}
+}
+
+/*
+ * No exception leaves these functions: a bad rom, a failed allocation or
+ * anything else thrown by the emulator is an error return.
+ */
+
+int gbpp_power_on(gbpp_emulator *gb, const char *path, const int skip_bios) {
+	gb->rom_loaded = false;
+	try {
+		gb->game_boy.power_on(path, skip_bios != 0);
+	} catch(const BadCartridge &) {
+		return -1;
+	} catch(...) {
+		return -1;
+	}
+	gb->rom_loaded = true;
+	return 0;
+}
+
+int gbpp_load_rom(gbpp_emulator *gb, const unsigned char *data, const size_t size, const int skip_bios) {
+	gb->rom_loaded = false;
+	try {
+		gb->game_boy.power_on(data, size, skip_bios != 0);
+	} catch(const BadCartridge &) {
+		return -1;
+	} catch(...) {
+		return -1;
+	}
+	gb->rom_loaded = true;
+	return 0;
+}
+
+const gbpp_observation *gbpp_step(gbpp_emulator *gb, const unsigned char input) {
+	if(!gb->rom_loaded) {
+		return 0;
+	}
+	try {
+		return observe(gb, gb->game_boy.step(input));
+	} catch(...) {
+		return 0;
+	}
+}
+
+const gbpp_observation *gbpp_step_cycles(gbpp_emulator *gb, const unsigned char input, const int cycles) {
+	if(!gb->rom_loaded) {
+		return 0;
+	}
+	try {
+		return observe(gb, gb->game_boy.step_cycles(input, cycles));
+	} catch(...) {
+		return 0;
+	}
+}
+
+void gbpp_set_input(gbpp_emulator *gb, const unsigned char input) {
+	gb->game_boy.set_input(input);
+}
+
+int gbpp_step_frames(gbpp_emulator *gb, const int count) {
+	if(!gb->rom_loaded) {
+		return -1;
+	}
+	const byte input = gb->game_boy.get_input();
+	try {
+		for(int i = 0; i < count; i++) {
+			observe(gb, gb->game_boy.step(input));
+		}
+	} catch(...) {
+		return -1;
+	}
+	return count > 0 ? count : 0;
+}
+
+const unsigned char *gbpp_framebuffer(gbpp_emulator *gb, int *pitch) {
+	if(pitch) {
+		*pitch = gb->observation.pitch;
+	}
+	return gb->observation.framebuffer;
+}
+
+size_t gbpp_state_size(gbpp_emulator *gb) {
+	return gb->rom_loaded ? gb->game_boy.state_size() : 0;
+}
+
+int gbpp_save_state(gbpp_emulator *gb, void *buffer, const size_t size) {
+	try {
+		return gb->rom_loaded && gb->game_boy.save_state(buffer, size) ? 0 : -1;
+	} catch(...) {
+		return -1;
+	}
+}
+
+int gbpp_load_state(gbpp_emulator *gb, const void *buffer, const size_t size) {
+	try {
+		if(!gb->rom_loaded || !gb->game_boy.load_state(buffer, size)) {
+			return -1;
+		}
+		// Take the frame of the state, nothing runs
+		observe(gb, gb->game_boy.step_cycles(gb->game_boy.get_input(), 0));
+	} catch(...) {
+		return -1;
+	}
+	return 0;
+}
+
+const unsigned char *gbpp_memory(gbpp_emulator *gb, const unsigned short addr) {
+	if(!gb->rom_loaded) {
+		return 0;
+	}
+	return gb->game_boy.get_memory(addr);
+}
+
+unsigned char gbpp_peek(gbpp_emulator *gb, const unsigned short addr) {
+	if(!gb->rom_loaded) {
+		return 0;
+	}
+	try {
+		return gb->game_boy.peek(addr);
+	} catch(...) {
+		return 0;
+	}
+}
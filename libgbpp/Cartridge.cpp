@@ -17,6 +17,9 @@
  */
 
 #include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <iterator>
 #include "Cartridge.h"
 
 namespace gbpp {
@@ -30,20 +33,44 @@ namespace gbpp {
 		if(!game_file.is_open()) {
 			throw BadCartridge("Error loading: " + game);
 		}
-		game_file.seekg(0x100, ios::beg);
-		game_file.read(reinterpret_cast<char *>(&header), sizeof(struct header));
-		
-		rom = new byte[GET_ROM_SIZE(header.rom_size)];
+		std::vector<char> data((std::istreambuf_iterator<char>(game_file)),
+			std::istreambuf_iterator<char>());
+		game_file.close();
+		load(reinterpret_cast<const byte *>(data.data()), data.size());
+	}
 
-		game_file.seekg(0, ios::beg);
-		game_file.read(reinterpret_cast<char *>(rom),
-			GET_ROM_SIZE(header.rom_size));
+	/**
+	 * Load a Cartridge image from memory, it is copied. A short image is
+	 * padded with zeros up to the size in its header.
+	 */
+	void Cartridge::load(const byte *data, const size_t size) {
+		rom_loaded = false;
+		if(!data || size < 0x150) {
+			throw BadCartridge("Rom too small.");
+		}
+		memcpy(&header, data + 0x100, sizeof(struct header));
+		if(header.rom_size > 8) {
+			throw BadCartridge("GBPP does not support this ROM size.");
+		}
+		delete[] rom;
+		rom = 0;
+		rom = new byte[GET_ROM_SIZE(header.rom_size)];
+		rom_size = GET_ROM_SIZE(header.rom_size);
+		memcpy(rom, data, size < rom_size ? size : rom_size);
+		if(size < rom_size) {
+			memset(rom + size, 0, rom_size - size);
+		}
 
 		verify_checksum();
 		detect_type();
 
+		// FNV-1a
+		checksum = 2166136261u;
+		for(size_t i = 0; i < rom_size; i++) {
+			checksum = (checksum ^ rom[i]) * 16777619u;
+		}
+
 		//debug_header();
-		game_file.close();
 		rom_loaded = true;
 	}
 	
@@ -51,6 +78,14 @@ namespace gbpp {
 		return rom_loaded;
 	}
 	
+	dword Cartridge::get_checksum() const {
+		return checksum;
+	}
+
+	size_t Cartridge::get_rom_size() const {
+		return rom_size;
+	}
+
 	byte* Cartridge::get_title() {
 		return header.title;
 	}
@@ -95,8 +130,10 @@ namespace gbpp {
 		}
 	}
 
-	byte Cartridge::read_byte(const word addr) const {
-		return rom[addr];
+	// Offset in the whole rom, a bank above the last one wraps like the
+	// unused bank bits of the MBC (the sizes are powers of two)
+	byte Cartridge::read_byte(const dword addr) const {
+		return rom[addr & (rom_size - 1)];
 	}
 	
 	void Cartridge::debug_header() const {
@@ -46,16 +46,21 @@ namespace gbpp {
 	class Cartridge {
 	public:
 		void load(const string game);
-		byte read_byte(const word addr) const;
+		void load(const byte *data, const size_t size);
+		byte read_byte(const dword addr) const;
 		Type get_type();
 		byte *get_title();
 		bool is_rom_loaded();
+		dword get_checksum() const;
+		size_t get_rom_size() const;
 		static Cartridge& get_instance();
 	private:
-		Cartridge() : rom_loaded(false) {}
+		Cartridge() : rom(0), rom_size(0), rom_loaded(false), checksum(0) {}
 		
 		byte *rom;
+		size_t rom_size;
 		bool rom_loaded;
+		dword checksum; // of the whole ROM, identifies it in the save states
 		
 		struct header {
 			byte entry[4];           // Usually "NOP; JP 0150h"
@@ -20,9 +20,13 @@
 #include "Memory.h"
 #include "Cartridge.h"
 #include "Lcd.h"
+#include "Apu.h"
+#include "Joypad.h"
 
 // Singleton accessors
 #define cpu Cpu::get_instance()
 #define memory Memory::get_instance()
 #define cartridge Cartridge::get_instance()
-#define lcd Lcd::get_instance()
\ No newline at end of file
+#define lcd Lcd::get_instance()
+#define apu Apu::get_instance()
+#define joypad Joypad::get_instance()
\ No newline at end of file
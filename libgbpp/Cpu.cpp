@@ -16,6 +16,7 @@
  *   along with this program. If not, see <http://www.gnu.org/licences>
  */
 
+#include <climits>
 #include "Cpu.h"
 
 
@@ -34,6 +35,7 @@ namespace gbpp {
     HL = 0x014D;
     SP = 0xFFFE;
     PC = start_pc;
+    in_bios = start_pc < 0x100;
     ime = true;
     pending_interupt_enabled = false;
     pending_interupt_disabled = false;
@@ -2295,6 +2297,67 @@ namespace gbpp {
     return result;
   }
 
+  void Cpu::save_state(StateWriter &state) const {
+    state.put(A.data);
+    state.put(static_cast<byte>(F));
+    state.put(B.data);
+    state.put(C.data);
+    state.put(D.data);
+    state.put(E.data);
+    state.put(H.data);
+    state.put(L.data);
+    state.put(PC.data);
+    state.put(SP.data);
+    state.put(ime);
+    state.put(pending_interupt_disabled);
+    state.put(pending_interupt_enabled);
+    state.put(halt);
+    state.put(clock_speed);
+    state.put(timer_counter);
+    state.put(divider_counter);
+    state.put(executed_instructions);
+    state.put(is_cbop);
+    state.put(in_bios);
+    state.put(speed_mode);
+    state.put(cpu_time);
+  }
+
+  // Timer and frame counters are checked, everything else takes any value
+  void Cpu::load_state(StateReader &state) {
+    byte flags = 0;
+    state.get(A.data);
+    state.get(flags);
+    state.get(B.data);
+    state.get(C.data);
+    state.get(D.data);
+    state.get(E.data);
+    state.get(H.data);
+    state.get(L.data);
+    state.get(PC.data);
+    state.get(SP.data);
+    state.get(ime);
+    state.get(pending_interupt_disabled);
+    state.get(pending_interupt_enabled);
+    state.get(halt);
+    const int speed = state.read<int>(clock_speed_available[1], clock_speed_available[0]);
+    bool known = false;
+    for(int i = 0; i < 4; i++) {
+      known = known || speed == clock_speed_available[i];
+    }
+    state.check(known);
+    state.get(timer_counter, 0, INT_MAX);
+    state.get(divider_counter, 0, INT_MAX);
+    state.get(executed_instructions);
+    state.get(is_cbop);
+    state.get(in_bios);
+    state.get(speed_mode, NORMAL_SPEED, DOUBLE_SPEED);
+    state.get(cpu_time, 0, static_cast<int>(DOUBLE_SPEED * MAX_CYCLES * 2));
+    if(state.is_applying()) {
+      F = flags;
+      clock_speed = speed;
+    }
+  }
+
   Cpu& Cpu::get_instance() {
     static Cpu inst;
     return inst;
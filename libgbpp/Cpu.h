@@ -28,6 +28,7 @@
 #include "util.h"
 #include "Components.h"
 #include "Register.h"
+#include "State.h"
 
 namespace gbpp {
 
@@ -146,6 +147,8 @@ namespace gbpp {
 		void set_clock_frequency();
 		void reset_divider_counter();
 		void request_interrupt(const int id);
+		void save_state(StateWriter &state) const;
+		void load_state(StateReader &state);
 		void debug(const Register16 pc) const;
 		string as_binary(const unsigned int number, const int len) const;
 		static Cpu& get_instance();
@@ -16,6 +16,7 @@
  *   along with this program. If not, see <http://www.gnu.org/licences>
  */
 
+#include <cstring>
 #include "GameBoy.h"
 
 namespace gbpp {
@@ -25,61 +26,356 @@ namespace gbpp {
 	 * This do a frame
 	 */
 	void GameBoy::frame() {
+		pace_frame();
 		int cycles;
 		while(cpu.can_execute()) {
 			cycles = cpu.execute();
 			lcd.update_graphics(cycles);
 		}
+		end_frame();
 	}
-	
-	// FIXME: change this, I dont like to mantain an joypad state variable
-	void GameBoy::key_pressed(const int key) {
-		bool previously_unset = false;
-		if(test_bit(memory.get_joypad_state(), key) == false) {
-			previously_unset = true;
+
+	void GameBoy::end_frame() {
+		apu.end_frame(cpu.max_cycles());
+		frames++;
+	}
+
+	// Auto frameskip looks at real time once a frame, before it runs
+	void GameBoy::pace_frame() {
+		if(frameskip == FRAMESKIP_AUTO) {
+			adjust_frameskip();
+		}
+	}
+
+	/**
+	 * Scripted drivers: press the keys of input (bit n for KEY_n), run
+	 * to the end of the frame and look at the result.
+	 */
+	GameBoy::Observation GameBoy::step(const byte input) {
+		joypad.set_buttons(input);
+		frame();
+		return observe();
+	}
+
+	/**
+	 * Same with at least cycles CPU cycles (whole instructions), crossing
+	 * frames if needed. Auto frameskip is paced at every frame end.
+	 */
+	GameBoy::Observation GameBoy::step_cycles(const byte input, const int cycles) {
+		joypad.set_buttons(input);
+		int done = 0;
+		while(done < cycles) {
+			if(!cpu.can_execute()) {
+				end_frame();
+				pace_frame();
+				continue;
+			}
+			const int executed = cpu.execute();
+			lcd.update_graphics(executed);
+			done += executed;
 		}
-		
-		memory.clear_joypad_state(key);
-		
-		byte key_req = memory.read_byte(Memory::P1);
-		bool req_int = false;
-		
-		if(!is_directional(key) && !(test_bit(key_req, 5))) {
-			req_int = true;
-		} else if(is_directional(key) && (test_bit(key_req, 4))) {
-			req_int = true;
+		// A frame that ran to its end is finished now, not by the next step
+		if(cpu.get_cpu_time() >= cpu.max_cycles()) {
+			cpu.can_execute();
+			end_frame();
+			pace_frame();
 		}
-		
-		if(req_int && !previously_unset) {
-			cpu.request_interrupt(Cpu::JOYPAD_INTERRUPT);
+		return observe();
+	}
+
+	GameBoy::Observation GameBoy::observe() {
+		bool changed = false;
+		if(lcd.is_frame_ready()) {
+			last_frame = lcd.get_framebuffer();
+			changed = lcd.frame_changed();
 		}
+		Observation observation = { last_frame, lcd.get_framebuffer_pitch(), changed, frames,
+			cpu.get_cpu_time() };
+		return observation;
+	}
+
+	// Pointer to the memory at addr (0x8000-0xFFFF), see Memory::get_pointer()
+	const byte *GameBoy::get_memory(const word addr) const {
+		return memory.get_pointer(addr);
+	}
+
+	// Any address, as the CPU reads it
+	byte GameBoy::peek(const word addr) const {
+		return memory.read_byte(addr);
+	}
+	
+	void GameBoy::key_pressed(const int key) {
+		joypad.press(key);
 	}
 	
 	bool GameBoy::is_directional(const int key) const {
 		return (key == KEY_RIGHT || key == KEY_LEFT || key == KEY_UP || key == KEY_DOWN);
 	}
 	
-	// FIXME: change this, I dont like to mantain an joypad state variable
 	void GameBoy::key_released(const int key) {
-		memory.set_joypad_state(key);
+		joypad.release(key);
+	}
+
+	// Pressed keys, bit n for KEY_n. The interrupt is requested as for key_pressed().
+	void GameBoy::set_input(const byte mask) {
+		joypad.set_buttons(mask);
 	}
 
-	void GameBoy::power_on(const string game, const bool skip_bios) const {
+	byte GameBoy::get_input() const {
+		return joypad.get_buttons();
+	}
+
+	void GameBoy::power_on(const string game, const bool skip_bios) {
 		cartridge.load(game);
+		reset(skip_bios);
+	}
+
+	// ROM image in memory, it is copied
+	void GameBoy::power_on(const byte *data, const size_t size, const bool skip_bios) {
+		cartridge.load(data, size);
+		reset(skip_bios);
+	}
+
+	void GameBoy::reset(const bool skip_bios) {
+		if(!cartridge.is_rom_loaded()) {
+			throw BadCartridge("Could not load the rom.");
+		}
+		cpu.reset(skip_bios ? 0x100 : 0x0);
 		memory.reset(skip_bios);
 		lcd.reset();
-		if(!skip_bios) {
-			cpu.reset(0x0);
+		apu.reset();
+		joypad.reset();
+		frames = 0;
+		last_frame = 0;
+	}
+
+	// Bytes of a save state of the loaded game
+	size_t GameBoy::state_size() const {
+		StateWriter state(0);
+		save_components(state);
+		return STATE_HEADER * sizeof(dword) + state.get_size();
+	}
+
+	// FNV-1a of the state after the header
+	static dword state_checksum(const byte *data, const size_t size) {
+		dword hash = 2166136261u;
+		for(size_t i = 0; i < size; i++) {
+			hash = (hash ^ data[i]) * 16777619u;
 		}
-		if(!cartridge.is_rom_loaded()) {
-			throw BadCartridge("Could not load the rom.");
+		return hash;
+	}
+
+	/**
+	 * Write the state of the machine to buffer, at least state_size()
+	 * bytes. The cartridge and the settings (color scheme, output,
+	 * frameskip, sample rate) are not part of it.
+	 */
+	bool GameBoy::save_state(void *buffer, const size_t size) const {
+		const size_t length = state_size();
+		if(!buffer || size < length) {
+			return false;
 		}
+		byte *data = static_cast<byte *>(buffer);
+		StateWriter state(data + STATE_HEADER * sizeof(dword));
+		save_components(state);
+		const dword header[STATE_HEADER] = { STATE_MAGIC, STATE_VERSION, cartridge.get_checksum(),
+			static_cast<dword>(length), state_checksum(data + sizeof(header), state.get_size()) };
+		memcpy(data, header, sizeof(header));
+		return true;
 	}
-	
+
+	/**
+	 * Restore a state saved with the same game by this build. The whole
+	 * state is checked first (header, checksum and the range of every
+	 * index), nothing changes if it is not valid. The sound output
+	 * restarts from silence.
+	 */
+	bool GameBoy::load_state(const void *buffer, const size_t size) {
+		const size_t length = state_size();
+		if(!buffer || size < length) {
+			return false;
+		}
+		const byte *data = static_cast<const byte *>(buffer);
+		dword header[STATE_HEADER];
+		memcpy(header, data, sizeof(header));
+		const byte *body = data + sizeof(header);
+		const size_t body_size = length - sizeof(header);
+		if(header[0] != STATE_MAGIC || header[1] != STATE_VERSION
+				|| header[2] != cartridge.get_checksum() || header[3] != length
+				|| header[4] != state_checksum(body, body_size)) {
+			return false;
+		}
+
+		StateReader check(body, body_size, false);
+		load_components(check);
+		if(!check.is_valid()) {
+			return false;
+		}
+		StateReader state(body, body_size, true);
+		load_components(state);
+		last_frame = 0; // the next observation takes the frame of the state
+		return true;
+	}
+
+	void GameBoy::save_components(StateWriter &state) const {
+		state.put(frames);
+		cpu.save_state(state);
+		memory.save_state(state);
+		joypad.save_state(state);
+		apu.save_state(state);
+		lcd.save_state(state);
+	}
+
+	// Memory before Lcd, which rebuilds its caches from it
+	void GameBoy::load_components(StateReader &state) {
+		state.get(frames);
+		cpu.load_state(state);
+		memory.load_state(state);
+		joypad.load_state(state);
+		apu.load_state(state);
+		lcd.load_state(state);
+	}
+
 	void GameBoy::use_color_scheme(const int scheme) {
 		lcd.use_color_scheme(scheme);
 	}
 
+	// OUTPUT_INDEXED skips the RGB conversion while rendering, the frame
+	// holds the shade (bits 0-1) and the palette (bits 2-3) of each pixel.
+	void GameBoy::set_output(const int output) {
+		lcd.set_output(output);
+	}
+
+	const byte *GameBoy::get_indexed_frame() const {
+		return lcd.get_frame();
+	}
+
+	void GameBoy::convert_indexed_frame(void *pixels, const int format, const int pitch) const {
+		lcd.convert_frame(format, static_cast<byte *>(pixels), pitch);
+	}
+
+	/**
+	 * Render the frames straight into pixels, HEIGHT rows of pitch bytes
+	 * in one of the FORMAT_* pixel formats. With a null pointer the frames
+	 * are rendered in internal triple buffers, in format.
+	 * Lines that did not change since the last frame are not drawn again,
+	 * pixels must keep its content between frames.
+	 */
+	void GameBoy::set_framebuffer(void *pixels, const int format, const int pitch) {
+		lcd.set_framebuffer(static_cast<byte *>(pixels), format, pitch);
+	}
+
+	/**
+	 * Latest complete frame. With the internal buffers it can be called from
+	 * another thread (a single consumer) while frame() renders the next one.
+	 */
+	const byte *GameBoy::get_framebuffer() const {
+		return lcd.get_framebuffer();
+	}
+
+	bool GameBoy::is_frame_ready() const {
+		return lcd.is_frame_ready();
+	}
+
+	/**
+	 * False when the frame taken by the last get_framebuffer() (or
+	 * get_indexed_frame()) is identical to the previous one, so it does not
+	 * need to be uploaded or encoded again.
+	 */
+	bool GameBoy::frame_changed() const {
+		return lcd.frame_changed();
+	}
+
+	/**
+	 * Generate the pixels of one frame out of frames + 1, the others only
+	 * keep the timing and the interrupts. FRAMESKIP_AUTO skips as many
+	 * frames as needed to keep up with real time.
+	 */
+	void GameBoy::set_frameskip(const int frames) {
+		frameskip = frames;
+		paced_frames = 0;
+		lcd.set_frameskip(frames == FRAMESKIP_AUTO ? 0 : frames);
+	}
+
+	int GameBoy::get_frameskip() const {
+		return frameskip;
+	}
+
+	// Accuracy mode of the LCD, PPU_FIFO for mid line raster effects
+	void GameBoy::set_ppu(const int ppu) {
+		lcd.set_ppu(ppu);
+	}
+
+	int GameBoy::get_ppu() const {
+		return lcd.get_ppu();
+	}
+
+	// Sound output rate in Hz, the samples of every frame are read with read_samples()
+	void GameBoy::set_sample_rate(const int rate) {
+		apu.set_sample_rate(rate);
+	}
+
+	int GameBoy::get_sample_rate() const {
+		return apu.get_sample_rate();
+	}
+
+	// Make slightly more (ratio > 1) or less samples, for audio rate control
+	void GameBoy::set_rate_ratio(const double ratio) {
+		apu.set_rate_ratio(ratio);
+	}
+
+	int GameBoy::samples_available() const {
+		return apu.samples_available();
+	}
+
+	// Up to count stereo samples (16 bit, left and right), returns how many were read
+	int GameBoy::read_samples(short *samples, const int count) {
+		return apu.read_samples(samples, count);
+	}
+
+	// Times samples were dropped because they were not read in time
+	unsigned int GameBoy::get_sample_overflows() const {
+		return apu.get_overflows();
+	}
+
+	// Off when nothing calls read_samples(): the sound is not made at all
+	void GameBoy::set_audio_enabled(const bool enabled) {
+		apu.set_output_enabled(enabled);
+	}
+
+	bool GameBoy::is_audio_enabled() const {
+		return apu.is_output_enabled();
+	}
+
+	// Skip as many frames as the emulation is behind real time
+	// Real frame rate of the hardware, about 59.73 frames a second
+	static const double FRAME_RATE = static_cast<double>(Cpu::CLOCK_SPEED) / Cpu::MAX_CYCLES;
+	// Late by less than this (in frames) is jitter, nothing is skipped
+	static const double SKIP_DEAD_BAND = 0.25;
+
+	void GameBoy::adjust_frameskip() {
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(paced_frames == 0) {
+			pace_start = now;
+		}
+		const double elapsed = std::chrono::duration<double>(now - pace_start).count();
+		const double behind = elapsed * FRAME_RATE - paced_frames;
+
+		if(behind > FRAME_RATE / 2) {
+			// Too late to catch up (paused or stalled), start again from now
+			paced_frames = 0;
+			lcd.set_frameskip(0);
+			return;
+		}
+		if(behind >= 1 + SKIP_DEAD_BAND) {
+			const double skip = behind - SKIP_DEAD_BAND;
+			lcd.set_frameskip(skip < MAX_AUTO_FRAMESKIP ? static_cast<int>(skip) : MAX_AUTO_FRAMESKIP);
+		} else {
+			lcd.set_frameskip(0);
+		}
+		paced_frames++;
+	}
+
 	// TODO: What put here?
 	void GameBoy::power_off() {
 	}
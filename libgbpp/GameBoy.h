@@ -21,6 +21,7 @@
 
 #include <iostream>
 #include <string>
+#include <chrono>
 using std::string;
 
 #include "util.h"
@@ -35,7 +36,7 @@ namespace gbpp {
 		static const int WIDTH  = Lcd::WIDTH;
 		static const int HEIGHT = Lcd::HEIGHT;
 
-		GameBoy() {}
+		GameBoy() : frameskip(0), paced_frames(0), frames(0), last_frame(0) {}
 		enum {
 			KEY_RIGHT,
 			KEY_LEFT,
@@ -49,15 +50,102 @@ namespace gbpp {
 
 		static const unsigned int FPS = 60;
 
+		// Hold real time speed, skipping up to MAX_AUTO_FRAMESKIP frames
+		static const int FRAMESKIP_AUTO = -1;
+		static const int MAX_AUTO_FRAMESKIP = 9;
+
+		enum {
+			OUTPUT_RGB = Lcd::OUTPUT_RGB,
+			OUTPUT_INDEXED = Lcd::OUTPUT_INDEXED
+		};
+
+		enum {
+			PPU_SCANLINE = Lcd::PPU_SCANLINE,
+			PPU_FIFO = Lcd::PPU_FIFO
+		};
+
+		enum {
+			FORMAT_RGB24 = Lcd::FORMAT_RGB24,
+			FORMAT_RGBA32 = Lcd::FORMAT_RGBA32,
+			FORMAT_BGRA32 = Lcd::FORMAT_BGRA32,
+			FORMAT_RGB565 = Lcd::FORMAT_RGB565,
+			FORMAT_GRAY8 = Lcd::FORMAT_GRAY8
+		};
+
+		/**
+		 * What a scripted driver sees after a step. It points into the
+		 * emulator, nothing is copied, and it is valid until the next step.
+		 */
+		struct Observation {
+			const byte *framebuffer; // latest complete frame, 0 before the first one
+			int pitch;
+			bool frame_changed;      // framebuffer differs from the previous step
+			unsigned int frames;     // frames completed since power on
+			int frame_cycles;        // CPU cycles into the current frame
+		};
+
 		void frame();
-		void power_on(const string game, const bool skip_bios) const;
+		Observation step(const byte input);
+		Observation step_cycles(const byte input, const int cycles);
+		const byte *get_memory(const word addr) const;
+		byte peek(const word addr) const;
+		void power_on(const string game, const bool skip_bios);
+		void power_on(const byte *data, const size_t size, const bool skip_bios);
 		void power_off();
+
+		size_t state_size() const;
+		bool save_state(void *buffer, const size_t size) const;
+		bool load_state(const void *buffer, const size_t size);
 		
 		bool is_directional(const int key) const;
 		void use_color_scheme(const int scheme);
+		void set_output(const int output);
+		const byte *get_indexed_frame() const;
+		void convert_indexed_frame(void *pixels, const int format, const int pitch) const;
+		void set_framebuffer(void *pixels, const int format, const int pitch);
+		const byte *get_framebuffer() const;
+		bool is_frame_ready() const;
+		bool frame_changed() const;
+		void set_frameskip(const int frames);
+		int get_frameskip() const;
+		void set_ppu(const int ppu);
+		int get_ppu() const;
+
+		void set_sample_rate(const int rate);
+		int get_sample_rate() const;
+		void set_rate_ratio(const double ratio);
+		int samples_available() const;
+		int read_samples(short *samples, const int count);
+		unsigned int get_sample_overflows() const;
+		void set_audio_enabled(const bool enabled);
+		bool is_audio_enabled() const;
 
 		void key_pressed(const int key);
 		void key_released(const int key);
+		void set_input(const byte mask);
+		byte get_input() const;
+
+	private:
+		int frameskip;
+
+		// Auto frameskip: frames run since start, to compare with real time
+		std::chrono::steady_clock::time_point pace_start;
+		unsigned int paced_frames;
+
+		unsigned int frames;
+		const byte *last_frame;
+
+		static const dword STATE_MAGIC = 0x50504247; // "GBPP"
+		static const dword STATE_VERSION = 1;
+		static const int STATE_HEADER = 5; // magic, version, game checksum, size, checksum
+
+		void reset(const bool skip_bios);
+		void save_components(StateWriter &state) const;
+		void load_components(StateReader &state);
+		void end_frame();
+		void pace_frame();
+		Observation observe();
+		void adjust_frameskip();
 	};
 
 	static const string KEY_NAMES[8] = {
@@ -0,0 +1,95 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include "Joypad.h"
+
+namespace gbpp {
+
+	Joypad::Joypad() : buttons(0), select(SELECT_DIRECTIONS | SELECT_BUTTONS), p1(0xFF) {}
+
+	void Joypad::reset() {
+		buttons = 0;
+		select = SELECT_DIRECTIONS | SELECT_BUTTONS;
+		p1 = 0xFF;
+	}
+
+	byte Joypad::read() const {
+		return p1;
+	}
+
+	// Only the select bits can be written
+	void Joypad::write(const byte data) {
+		const byte new_select = data & (SELECT_DIRECTIONS | SELECT_BUTTONS);
+		if(new_select != select) {
+			select = new_select;
+			update();
+		}
+	}
+
+	// The whole input at once, for scripted drivers
+	void Joypad::set_buttons(const byte mask) {
+		if(mask != buttons) {
+			buttons = mask;
+			update();
+		}
+	}
+
+	byte Joypad::get_buttons() const {
+		return buttons;
+	}
+
+	void Joypad::press(const int key) {
+		set_buttons(buttons | (1 << key));
+	}
+
+	void Joypad::release(const int key) {
+		set_buttons(buttons & ~(1 << key));
+	}
+
+	// Lines are low (0) when a key of a selected group is pressed
+	void Joypad::update() {
+		byte lines = 0x0F;
+		if(!(select & SELECT_DIRECTIONS)) {
+			lines &= ~buttons & 0x0F;
+		}
+		if(!(select & SELECT_BUTTONS)) {
+			lines &= ~(buttons >> 4) & 0x0F;
+		}
+		if(p1 & ~lines & 0x0F) {
+			cpu.request_interrupt(Cpu::JOYPAD_INTERRUPT);
+		}
+		p1 = 0xC0 | select | lines;
+	}
+
+	void Joypad::save_state(StateWriter &state) const {
+		state.put(buttons);
+		state.put(select);
+		state.put(p1);
+	}
+
+	void Joypad::load_state(StateReader &state) {
+		state.get(buttons);
+		state.get(select);
+		state.get(p1);
+	}
+
+	Joypad& Joypad::get_instance() {
+		static Joypad inst;
+		return inst;
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _JOYPAD_H_
+#define _JOYPAD_H_
+
+#include "types.h"
+#include "util.h"
+#include "Components.h"
+#include "State.h"
+
+namespace gbpp {
+
+	/**
+	 * The P1 register (0xFF00) and the button matrix.
+	 *
+	 * The buttons are a mask of pressed keys, one bit per GameBoy::KEY_*
+	 * (directions in bits 0-3, A, B, Select and Start in bits 4-7). P1 is
+	 * computed only when the mask or the select bits change, reading it
+	 * just returns the latched value. The joypad interrupt is requested
+	 * when one of the input lines (P10-P13) goes from high to low.
+	 */
+	class Joypad {
+	public:
+		void reset();
+
+		byte read() const;
+		void write(const byte data);
+
+		void set_buttons(const byte mask);
+		byte get_buttons() const;
+		void press(const int key);
+		void release(const int key);
+
+		void save_state(StateWriter &state) const;
+		void load_state(StateReader &state);
+
+		static Joypad& get_instance();
+
+	private:
+		Joypad();
+
+		static const byte SELECT_DIRECTIONS = 0x10; // P14, low selects
+		static const byte SELECT_BUTTONS    = 0x20; // P15, low selects
+
+		byte buttons; // pressed keys
+		byte select;  // bits 4-5 as written
+		byte p1;      // value read from 0xFF00
+
+		void update();
+	};
+}
+
+#endif /* _JOYPAD_H_ */
@@ -16,437 +16,919 @@
  *   along with this program. If not, see <http://www.gnu.org/licences>
  */
 
+#include <cstring>
+#include <climits>
 #include "Lcd.h"
+#include "Simd.h"
 
 namespace gbpp {
 	
-	Lcd::Lcd() : scanline_counter(0), selected_color_scheme(0) {
+	Lcd::Lcd() : mode(MODE_2), mode_cycles(CYCLES_MODE2), selected_color_scheme(0), frame_dirty(false),
+		last_frame_changed(false), frame_version(0), front_version(0), front_changed(false),
+		line_sprites_count(0), output(OUTPUT_RGB), ppu(PPU_SCANLINE),
+		window_y_reached(false), window_line(0), fifo_dots(0), frameskip(0), skipped_frames(0), skip_frame(false),
+		back_buffer(0), last_buffer(0), front_buffer(1), ready_buffer(2) {
+		memset(shades, 0, sizeof(shades));
+		memset(tile_versions, 0, sizeof(tile_versions));
+		memset(map_versions, 0, sizeof(map_versions));
+		memset(buffer_versions, 0, sizeof(buffer_versions));
+		set_framebuffer(0, FORMAT_RGB24, 0);
+		invalidate_tiles();
 	}
 
     void Lcd::reset() {
-        clear_screen();
+        mode = MODE_2;
+        mode_cycles = CYCLES_MODE2;
+        memory.set_lcd_status((memory.read_byte(Memory::STAT) & 0xFC) | MODE_2);
+        update_coincidence();
+        invalidate_tiles();
+        update_palettes();
+        skipped_frames = 0;
+        skip_frame = false;
+        for(int i = 0; i < SPRITES * 4; i++) {
+            update_oam(Memory::OAM + i, memory.read_byte(Memory::OAM + i));
+        }
     }
 
-    void Lcd::clear_screen() {}
+	/**
+	 * PPU state machine. Every line is OAM scan (mode 2), pixel transfer
+	 * (mode 3) and HBlank (mode 0), then 10 lines of VBlank (mode 1).
+	 * mode_cycles counts down to the next transition, update_graphics()
+	 * only calls this when it is due.
+	 */
+	void Lcd::next_mode() {
+		while(mode_cycles <= 0) {
+			if(!is_lcd_enabled()) {
+				// Nothing to do until the LCD is switched on, just check again later
+				mode_cycles += HBLANK;
+				continue;
+			}
+			switch(mode) {
+			case MODE_2:
+				set_mode(MODE_3);
+				if(ppu == PPU_FIFO) {
+					// Run the FIFO with the CPU, one look after every instruction
+					start_fifo_line(memory.read_byte(Memory::LY));
+					mode_cycles += 1;
+				} else {
+					mode_cycles += CYCLES_MODE3;
+				}
+				break;
+			case MODE_3:
+				if(ppu == PPU_FIFO) {
+					// Dots since the last look, the line may end in the middle
+					const int dots = 1 - mode_cycles;
+					const int used = step_fifo(dots);
+					if(line_x < WIDTH) {
+						mode_cycles = 1;
+						break;
+					}
+					if(window_drawn) {
+						window_line++;
+					}
+					set_mode(MODE_0);
+					mode_cycles = HBLANK - CYCLES_MODE2 - fifo_dots - (dots - used);
+					break;
+				}
+				if(!skip_frame) {
+					draw_line(memory.read_byte(Memory::LY));
+				}
+				set_mode(MODE_0);
+				mode_cycles += CYCLES_MODE0;
+				break;
+			case MODE_0:
+				next_line();
+				if(memory.read_byte(Memory::LY) == VBLANK) {
+					start_vblank();
+					set_mode(MODE_1);
+					mode_cycles += CYCLES_MODE1;
+				} else {
+					set_mode(MODE_2);
+					mode_cycles += CYCLES_MODE2;
+				}
+				break;
+			case MODE_1:
+				next_line();
+				if(memory.read_byte(Memory::LY) == 0) {
+					set_mode(MODE_2);
+					mode_cycles += CYCLES_MODE2;
+				} else {
+					mode_cycles += CYCLES_MODE1;
+				}
+				break;
+			}
+		}
+	}
 
-	// TODO: This code is very ugly. I can write something better!.
-    void Lcd::set_lcd_status() {
-        byte status = memory.read_byte(Memory::STAT);
+	// Enter a mode, with its STAT interrupt (bit 3 HBlank, 4 VBlank, 5 OAM)
+	void Lcd::set_mode(const int _mode) {
+		static const int interrupt_bits[] = { 3, 4, 5, -1 };
+		mode = _mode;
+		const byte status = (memory.read_byte(Memory::STAT) & 0xFC) | mode;
+		memory.set_lcd_status(status);
+		if(interrupt_bits[mode] != -1 && test_bit(status, interrupt_bits[mode])) {
+			cpu.request_interrupt(Cpu::LCD_INTERRUPT);
+		}
+	}
 
-        if(!is_lcd_enabled()) {
-			reset_scanline_counter();
-            memory.write_byte(Memory::LY, 0);
-            status = (status & 0xFC) | 1;
-            memory.write_byte(Memory::STAT, status);
-            return;
-        }
+	void Lcd::next_line() {
+		memory.increment_ly();
+		if(memory.read_byte(Memory::LY) > VBLANK_MAX) {
+			memory.set_ly(0);
+		}
+		update_coincidence();
+	}
 
-        byte LY = memory.read_byte(Memory::LY);
-        byte current_mode = get_current_mode();
-
-        byte mode = MODE_0;
-        bool req_int = false;
-
-        if(LY >= VBLANK) { // Vertical blank
-            mode = MODE_1;
-            status = (status & 0xFC) | 1;
-            req_int = test_bit(status, 4);
-        } else {
-			if(scanline_counter <= CYCLES_MODE2) { // accessing OAM
-				mode = MODE_2;
-				status = (status & 0xFC) | 2;
-                req_int = test_bit(status, 5);
-			} else if(scanline_counter <= CYCLES_MODE3) { // accessing VRAM
-				mode = MODE_3;
-				status |= 3;
-			} else { // Horizontal blank
-				mode = MODE_0;
-				status &= 0xFC;
-                req_int = test_bit(status, 3);
+	// Frame done: publish it (unless skipped) and request the VBlank interrupt
+	void Lcd::start_vblank() {
+		if(skip_frame) {
+			skipped_frames++;
+		} else {
+			last_frame_changed = frame_dirty;
+			if(frame_dirty) {
+				frame_version++;
 			}
-        }
+			frame_dirty = false;
+			buffer_versions[back_buffer] = frame_version;
+			swap_buffers();
+			skipped_frames = 0;
+		}
+		skip_frame = skipped_frames < frameskip;
+		window_y_reached = false;
+		window_line = 0;
+		cpu.request_interrupt(Cpu::VBLANK_INTERRUPT);
+	}
 
-        if(req_int && (mode != current_mode)) {
-            cpu.request_interrupt(Cpu::LCD_INTERRUPT);
-        }
+	// LY=LYC coincidence flag and interrupt, on every new line and LYC write
+	void Lcd::update_coincidence() {
+		byte status = memory.read_byte(Memory::STAT);
+		if(memory.read_byte(Memory::LY) == memory.read_byte(Memory::LYC)) {
+			if(!test_bit(status, 2) && test_bit(status, 6)) {
+				cpu.request_interrupt(Cpu::LCD_INTERRUPT);
+			}
+			set_bit(status, 2);
+		} else {
+			clear_bit(status, 2);
+		}
+		memory.set_lcd_status(status);
+	}
+
+	// Called by Memory when LCDC bit 7 changes. Off: LY is 0 and the mode
+	// HBlank. On: the first line starts from its OAM scan. The lines drawn
+	// so far are dropped with their frame, none can be reused.
+	void Lcd::switch_lcd(const bool on) {
+		invalidate_lines();
+		memory.set_ly(0);
+		if(on) {
+			set_mode(MODE_2);
+			mode_cycles = CYCLES_MODE2;
+			update_coincidence();
+		} else {
+			mode = MODE_0;
+			memory.set_lcd_status(memory.read_byte(Memory::STAT) & 0xFC);
+		}
+	}
 
-        memory.write_byte(Memory::STAT, status);
+    bool Lcd::is_lcd_enabled() const {
+        return test_bit(memory.read_byte(Memory::LCDC), 7);
     }
 
-	/*void Lcd::start_mode_zero() {}
-	void Lcd::start_mode_one() {}
-	void Lcd::start_mode_two() {}
-	void Lcd::start_mode_three() {}*/
+	// Index in the tile cache of a background/window tile, LCDC bit 4 selects
+	// between unsigned (0x8000) and signed (0x8800) tile numbers.
+	inline int Lcd::tile_index(const byte lcdc, const byte tile_num) const {
+		if(test_bit(lcdc, 4)) {
+			return tile_num;
+		}
+		return 256 + static_cast<sbyte>(tile_num);
+	}
+
+	// Called by Memory when the tile data area (0x8000-0x97FF) changes.
+	void Lcd::invalidate_tile(const word addr) {
+		const int tile = (addr - Memory::VRAM) / 16;
+		dirty_tiles[tile] = true;
+		tile_versions[tile]++;
+	}
+
+	// Called by Memory when a tile map (0x9800-0x9FFF) changes.
+	void Lcd::invalidate_map(const word addr) {
+		map_versions[(addr - Memory::BTM0) / 32]++;
+	}
 
-    void Lcd::update_graphics(const int cycles) {
-        set_lcd_status();
+	void Lcd::invalidate_tiles() {
+		for(int tile = 0; tile < TILES; tile++) {
+			dirty_tiles[tile] = true;
+			tile_versions[tile]++;
+		}
+		invalidate_lines();
+	}
 
-        if(is_lcd_enabled()) {
-            scanline_counter += cycles;
+	// Redraw every line of the next frame
+	void Lcd::invalidate_lines() {
+		for(int line = 0; line < HEIGHT; line++) {
+			valid_lines[line] = false;
 		}
-		
-		if(memory.read_byte(Memory::LY) > VBLANK_MAX) {
-			memory.write_byte(Memory::LY, 0);
+	}
+
+	// Compute the key of a line and keep it, false if the line of the last
+	// drawn frame had the same one.
+	bool Lcd::update_line_key(const byte lcdc, const int LY) {
+		LineKey key;
+		memset(&key, 0, sizeof(key));
+		key.registers[0] = lcdc;
+		key.registers[1] = memory.read_byte(Memory::SCY);
+		key.registers[2] = memory.read_byte(Memory::SCX);
+		key.registers[3] = memory.read_byte(Memory::WY);
+		key.registers[4] = memory.read_byte(Memory::WX);
+		key.registers[5] = memory.read_byte(Memory::BGP);
+		key.registers[6] = memory.read_byte(Memory::OBP0);
+		key.registers[7] = memory.read_byte(Memory::OBP1);
+
+		const byte *vram = memory.get_vram();
+		if(test_bit(lcdc, 0)) {
+			const byte y_pos = key.registers[1] + LY;
+			const int map_row = (test_bit(lcdc, 3) ? 32 : 0) + y_pos / 8;
+			const byte *map = vram + (Memory::BTM0 - Memory::VRAM) + map_row * 32;
+			key.maps += map_versions[map_row];
+			for(int i = 0; i <= WIDTH / 8; i++) {
+				key.tiles += tile_versions[tile_index(lcdc, map[(key.registers[2] / 8 + i) & 31])];
+			}
 		}
-		
-		if(scanline_counter > HBLANK) {
-			scanline();
+
+		const byte window_x = key.registers[4] - 7;
+		if(test_bit(lcdc, 5) && LY >= key.registers[3] && window_x < WIDTH) {
+			const int map_row = (test_bit(lcdc, 6) ? 32 : 0) + (LY - key.registers[3]) / 8;
+			const byte *map = vram + (Memory::BTM0 - Memory::VRAM) + map_row * 32;
+			key.maps += map_versions[map_row];
+			for(int i = 0; i < (WIDTH - window_x + 7) / 8; i++) {
+				key.tiles += tile_versions[tile_index(lcdc, map[i])];
+			}
 		}
-    }
 
-	void Lcd::reset_scanline_counter() {
-		if(scanline_counter > HBLANK) {
-			scanline_counter -= HBLANK; // adjust scanline_counter, to be very accurate	
-		} else {
-			scanline_counter = 0;
+		const int y_size = test_bit(lcdc, 2) ? 16 : 8;
+		key.sprites_count = line_sprites_count;
+		for(int i = 0; i < line_sprites_count; i++) {
+			const Sprite &sprite = oam[line_sprites[i]];
+			int line = LY - sprite.y;
+			if(test_bit(sprite.attributes, 6)) {
+				line = y_size - 1 - line;
+			}
+			const int tile = (y_size == 16 ? sprite.tile & 0xFE : sprite.tile) + line / 8;
+			key.sprites[i] = ((sprite.x + 8) & 0xFF) | (tile << 8) | ((line % 8) << 17)
+				| ((sprite.attributes & 0xB0) << 20);
+			key.tiles += tile_versions[tile];
+		}
+
+		if(valid_lines[LY] && memcmp(&key, &line_keys[LY], sizeof(key)) == 0) {
+			return false;
 		}
+		line_keys[LY] = key;
+		valid_lines[LY] = true;
+		return true;
 	}
-	
-	void Lcd::scanline() {
-		if(!is_lcd_enabled()) {
+
+	// Unchanged line: the caller buffer already has it, the back buffer
+	// takes it from the last published frame.
+	void Lcd::copy_line(const int LY) {
+		if(framebuffer && output == OUTPUT_RGB) {
 			return;
 		}
-		reset_scanline_counter();
+		const int size = output == OUTPUT_INDEXED ? WIDTH : WIDTH * bytes_per_pixel(framebuffer_format);
+		memcpy(buffers[back_buffer] + LY * size, buffers[last_buffer] + LY * size, size);
+	}
 
-		byte LY = memory.read_byte(Memory::LY);
-		byte status = memory.read_byte(Memory::STAT);
+	void Lcd::draw_line(const int LY) {
+		const byte lcdc = memory.read_byte(Memory::LCDC);
+		line_sprites_count = 0;
+		if(test_bit(lcdc, 1)) {
+			scan_oam(LY, test_bit(lcdc, 2) ? 16 : 8);
+		}
 
-		if(LY == VBLANK) {
-			cpu.request_interrupt(Cpu::VBLANK_INTERRUPT);
-		}
-		
-		if(LY > VBLANK_MAX) {
-			memory.write_byte(Memory::LY, 0);
-		}
-		if(LY < VBLANK) {
-			if(is_lcd_enabled()) {
-				// inneficient. draw_background and draw_window could be done at the same time
-				draw_background();
-		        draw_window();
-		        draw_sprites();
-			}
-		}
-		
-		if(LY == memory.read_byte(Memory::LYC)) {
-            set_bit(status, 2);
-            if(test_bit(status, 6)) {
-                cpu.request_interrupt(Cpu::LCD_INTERRUPT);
-            }
-        } else {
-            clear_bit(status, 2);
-        }
-        memory.write_byte(Memory::STAT, status);
-		
-		memory.increment_ly();
+		if(!update_line_key(lcdc, LY)) {
+			copy_line(LY);
+			return;
+		}
+		frame_dirty = true;
+		compose_line(LY);
+		output_line(LY);
 	}
 
-    byte Lcd::get_current_mode() const {
-        return memory.read_byte(Memory::STAT) & 0x3;
-    }
+	/**
+	 * Pixel FIFO PPU: mode 3 is run dot by dot with the CPU, so SCX, window,
+	 * LCDC and palette writes in the middle of a line take effect from the
+	 * next pixel. Its length depends on the fine scroll, the window and the
+	 * sprites (172 dots without them).
+	 */
+	void Lcd::start_fifo_line(const int LY) {
+		const byte lcdc = memory.read_byte(Memory::LCDC);
+		line_sprites_count = 0;
+		if(test_bit(lcdc, 1)) {
+			scan_oam(LY, test_bit(lcdc, 2) ? 16 : 8);
+		}
+		if(LY == memory.read_byte(Memory::WY)) {
+			window_y_reached = true;
+		}
 
-    bool Lcd::is_lcd_enabled() const {
-        return test_bit(memory.read_byte(Memory::LCDC), 7);
-    }
+		bg_head = 0;
+		bg_count = 0;
+		memset(obj_fifo, 0, sizeof(obj_fifo));
+		obj_head = 0;
+		fetch_step = -7; // the first fetch is done twice
+		fetch_x = 0;
+		fetching_window = false;
+		window_drawn = false;
+		line_x = 0;
+		discard = memory.read_byte(Memory::SCX) % 8;
+		next_sprite = 0;
+		sprite_stall = 0;
+		penalty_column = -1;
+		fifo_dots = 0;
+		set_fifo_line(LY);
+	}
 
-    bool Lcd::is_window_enabled() const {
-        return test_bit(memory.read_byte(Memory::LCDC), 5);
-    }
+	// Pixels are written as they leave the FIFO, with the palettes of that moment
+	void Lcd::set_fifo_line(const int LY) {
+		fifo_line = 0;
+		if(!skip_frame) {
+			valid_lines[LY] = false;
+			frame_dirty = true;
+			if(output == OUTPUT_INDEXED) {
+				fifo_bpp = 1;
+				fifo_line = buffers[back_buffer] + LY * WIDTH;
+			} else {
+				fifo_bpp = bytes_per_pixel(framebuffer_format);
+				fifo_line = framebuffer ? framebuffer + LY * framebuffer_pitch
+					: buffers[back_buffer] + LY * WIDTH * fifo_bpp;
+			}
+		}
+	}
 
-    bool Lcd::is_background_enabled() const {
-        return test_bit(memory.read_byte(Memory::LCDC), 0);
-    }
+	// Run up to dots dots of mode 3, returns the dots used (less if the line ended)
+	int Lcd::step_fifo(const int dots) {
+		int dot = 0;
+		while(dot < dots && line_x < WIDTH) {
+			dot++;
+			fifo_dots++;
 
-    bool Lcd::is_sprites_enabled() const {
-        return test_bit(memory.read_byte(Memory::LCDC), 1);
-    }
+			if(sprite_stall > 0) {
+				if(--sprite_stall == 0) {
+					fetch_fifo_sprite();
+				}
+				continue;
+			}
 
-    // FIXME: Rewrite this. I can write something better.
-    void Lcd::draw_background() {
-        if(is_background_enabled()) {
-            word tile_data = 0;
-            word background_memory = 0;
-            bool is_unsigned = true;
+			const byte lcdc = memory.read_byte(Memory::LCDC);
+
+			// Sprite at this pixel: 6 dots, plus waiting for the background
+			// fetch of the tile to end for the first sprite on it
+			if(test_bit(lcdc, 1) && next_sprite < line_sprites_count) {
+				const Sprite &sprite = oam[line_sprites[next_sprite]];
+				if(sprite.x <= -8 || sprite.x >= WIDTH) {
+					next_sprite++;
+				} else if(sprite.x <= line_x && discard == 0) {
+					const int column = (line_x + memory.read_byte(Memory::SCX)) / 8;
+					sprite_stall = 6;
+					if(column != penalty_column) {
+						const int offset = (line_x + memory.read_byte(Memory::SCX)) % 8;
+						sprite_stall += 5 - (offset < 5 ? offset : 5);
+						penalty_column = column;
+					}
+					continue;
+				}
+			}
 
-            byte scroll_y = memory.read_byte(Memory::SCY);
-            byte scroll_x = memory.read_byte(Memory::SCX);
+			// The window starts at WX - 7: the FIFO is cleared and the fetcher
+			// restarts on the window tiles
+			const byte window_x = memory.read_byte(Memory::WX);
+			if(!fetching_window && test_bit(lcdc, 5) && window_y_reached && window_x <= 166
+				&& line_x + 7 >= window_x && discard == 0) {
+				fetching_window = true;
+				window_drawn = true;
+				bg_count = 0;
+				fetch_step = 0;
+				fetch_x = 0;
+				discard = window_x < 7 ? 7 - window_x : 0;
+			}
+
+			if(fetch_step < 6) {
+				fetch_step++;
+			}
+			if(fetch_step == 6 && bg_count == 0) {
+				fetch_fifo_tile();
+				fetch_step = 0;
+			}
+
+			if(bg_count == 0) {
+				continue;
+			}
+			const byte color_num = bg_fifo[bg_head];
+			bg_head = (bg_head + 1) & 7;
+			bg_count--;
+			if(discard > 0) {
+				discard--;
+				continue;
+			}
+
+			ObjPixel &obj = obj_fifo[obj_head];
+			const bool blank = !test_bit(lcdc, 0);
+			byte pixel = blank ? 0 : color_num;
+			// OBJ-to-BG Priority, BG color 0 is always behind OBJ
+			if(obj.color != 0 && (pixel == 0 || !(obj.flags & BEHIND_BG))) {
+				pixel = (obj.flags & 0x0C) | obj.color;
+			} else if(blank) {
+				pixel = BLANK_PIXEL;
+			}
+			obj.color = 0;
+			obj_head = (obj_head + 1) & 7;
+			push_fifo_pixel(pixel);
+		}
+		return dot;
+	}
+
+	// Background or window tile line, 8 pixels in the empty FIFO
+	void Lcd::fetch_fifo_tile() {
+		const byte lcdc = memory.read_byte(Memory::LCDC);
+		const int LY = memory.read_byte(Memory::LY);
+		word map_row;
+		int line;
+		int column;
+		if(fetching_window) {
+			map_row = (test_bit(lcdc, 6) ? Memory::BTM1 : Memory::BTM0) + ((window_line / 8) & 31) * 32; // the map wraps
+			line = window_line % 8;
+			column = fetch_x;
+		} else {
+			const byte y_pos = memory.read_byte(Memory::SCY) + LY;
+			map_row = (test_bit(lcdc, 3) ? Memory::BTM1 : Memory::BTM0) + (y_pos / 8) * 32;
+			line = y_pos % 8;
+			column = memory.read_byte(Memory::SCX) / 8 + fetch_x;
+		}
+		fetch_tile_line(map_row, lcdc, line, column, 1, bg_fifo);
+		bg_head = 0;
+		bg_count = 8;
+		fetch_x++;
+	}
+
+	// Merge the sprite at next_sprite in the sprite FIFO, pixels already
+	// taken by a sprite with more priority are kept
+	void Lcd::fetch_fifo_sprite() {
+		const byte lcdc = memory.read_byte(Memory::LCDC);
+		const int LY = memory.read_byte(Memory::LY);
+		const int y_size = test_bit(lcdc, 2) ? 16 : 8;
+		const Sprite &sprite = oam[line_sprites[next_sprite++]];
+
+		byte tile_location = sprite.tile;
+		if(y_size == 16) {
+			clear_bit(tile_location, 0);
+		}
+		int line = LY - sprite.y;
+		if(test_bit(sprite.attributes, 6)) { // y flip
+			line = y_size - 1 - line;
+		}
+		line &= y_size - 1;
+
+		const byte *color_nums = tile_row(tile_location + line / 8, line % 8,
+			test_bit(sprite.attributes, 5));
+		byte flags = (get_bit(sprite.attributes, 4) + 1) << 2;
+		if(test_bit(sprite.attributes, 7)) {
+			flags |= BEHIND_BG;
+		}
+
+		for(int x_pix = 0; x_pix < 8; x_pix++) {
+			const int slot = sprite.x + x_pix - line_x;
+			if(slot < 0 || slot >= 8 || color_nums[x_pix] == 0) {
+				continue;
+			}
+			ObjPixel &obj = obj_fifo[(obj_head + slot) & 7];
+			if(obj.color == 0) {
+				obj.color = color_nums[x_pix];
+				obj.flags = flags;
+			}
+		}
+	}
+
+	void Lcd::push_fifo_pixel(const byte pixel) {
+		if(fifo_line) {
+			if(output == OUTPUT_INDEXED) {
+				fifo_line[line_x] = shades[pixel];
+			} else {
+				memcpy(fifo_line + line_x * fifo_bpp, palettes[pixel], fifo_bpp);
+			}
+		}
+		line_x++;
+	}
 
-            if(test_bit(memory.read_byte(Memory::LCDC), 4)) {
-                tile_data = 0x8000;
-            } else {
-                tile_data = 0x8800;
-                is_unsigned = false;
-            }
+	void Lcd::decode_tile(const int tile) {
+		expand_2bpp(memory.get_vram() + tile * 16, 8, tile_cache[tile][0]);
+		for(int line = 0; line < 8; line++) {
+			for(int x = 0; x < 8; x++) {
+				tile_cache_flipped[tile][line][x] = tile_cache[tile][line][7 - x];
+			}
+		}
+		dirty_tiles[tile] = false;
+	}
 
-            if(test_bit(memory.read_byte(Memory::LCDC), 3)) {
-                background_memory = 0x9C00;
-            } else {
-                background_memory = 0x9800;
-            }
+	// Decoded color numbers of one tile line, re-decoded only if VRAM changed.
+	const byte *Lcd::tile_row(const int tile, const int line, const bool x_flip) {
+		if(dirty_tiles[tile]) {
+			decode_tile(tile);
+		}
+		return x_flip ? tile_cache_flipped[tile][line] : tile_cache[tile][line];
+	}
 
-            byte y_pos = scroll_y + memory.read_byte(Memory::LY);
+	// Fetch count tiles from a tile map row, starting at tile_col and wrapping
+	// at 32, and copy the given line of each one into out (8 pixels per tile).
+	void Lcd::fetch_tile_line(const word map_row, const byte lcdc, const int line,
+		const int tile_col, const int count, byte *out) {
+		const byte *map = memory.get_vram() + (map_row - Memory::VRAM);
 
-            word tile_row = static_cast<byte>(y_pos / 8) * 32;
-            for(int pixel = 0; pixel < WIDTH; pixel++) {
-                byte x_pos = pixel + scroll_x;
+		for(int i = 0; i < count; i++) {
+			memcpy(out, tile_row(tile_index(lcdc, map[(tile_col + i) & 31]), line, false), 8);
+			out += 8;
+		}
+	}
 
-                word tile_col = (x_pos / 8);
+	// Background color numbers of the line, returns the first visible pixel
+	// (the first tile may be partially scrolled out).
+	const byte *Lcd::draw_background(const byte lcdc, const int LY, byte *colors) {
+		if(!test_bit(lcdc, 0)) {
+			memset(colors, 0, WIDTH);
+			return colors;
+		}
 
-                sword tile_num;
-                word tile_address = background_memory + tile_row + tile_col;
+		const byte scroll_x = memory.read_byte(Memory::SCX);
+		const byte y_pos = memory.read_byte(Memory::SCY) + LY;
+		const word background_memory = test_bit(lcdc, 3) ? Memory::BTM1 : Memory::BTM0;
 
-                if(is_unsigned) {
-                    tile_num = static_cast<byte>(memory.read_byte(tile_address));
-                } else {
-                    tile_num = static_cast<sbyte>(memory.read_byte(tile_address));
-                }
+		// 21 tiles
+		fetch_tile_line(background_memory + (y_pos / 8) * 32, lcdc, y_pos % 8,
+			scroll_x / 8, WIDTH / 8 + 1, colors);
+		return colors + (scroll_x % 8);
+	}
 
-                word tile_location = tile_data;
+	// Window color numbers of the line, returns the first pixel covered by
+	// the window, WIDTH if it is not on the line.
+	int Lcd::draw_window(const byte lcdc, const int LY, byte *colors) {
+		if(!test_bit(lcdc, 5)) {
+			return WIDTH;
+		}
 
-                if(is_unsigned) {
-                    tile_location += (tile_num * 16);
-                } else {
-                    tile_location += (tile_num + 128) * 16;
-                }
+		const byte window_y = memory.read_byte(Memory::WY);
+		const byte window_x = memory.read_byte(Memory::WX) - 7;
 
-                byte line = y_pos % 8;
-                line *= 2;
+		// FIXME: Not sure on this. It work for all games I have tested
+		if(LY < window_y || window_x >= WIDTH) {
+			return WIDTH;
+		}
 
-                byte data1 = memory.read_byte(tile_location + line);
-                byte data2 = memory.read_byte(tile_location + line + 1);
+		const byte y_pos = LY - window_y;
+		const word window_memory = test_bit(lcdc, 6) ? Memory::BTM1 : Memory::BTM0;
 
-                int color_bit = x_pos % 8;
-                color_bit -= 7;
-                color_bit *= -1;
+		fetch_tile_line(window_memory + (y_pos / 8) * 32, lcdc, y_pos % 8,
+			0, (WIDTH - window_x + 7) / 8, colors);
+		return window_x;
+	}
 
-                int color_num = get_bit(data2, color_bit);
-                color_num <<= 1;
-                color_num |= get_bit(data1, color_bit);
+	// Called by Memory on every write to the OAM (0xFE00-0xFE9F), DMA included.
+	void Lcd::update_oam(const word addr, const byte data) {
+		Sprite &sprite = oam[(addr - Memory::OAM) / 4];
+		switch((addr - Memory::OAM) % 4) {
+		case 0:
+			sprite.y = data - 16;
+			break;
+		case 1:
+			sprite.x = data - 8;
+			break;
+		case 2:
+			sprite.tile = data;
+			break;
+		case 3:
+			sprite.attributes = data;
+			break;
+		}
+	}
 
-                Color col = get_color(color_num, Memory::BGP);
+	// OAM scan: select the first 10 sprites (in OAM order) on the line and sort
+	// them by priority, the sprite with the smaller x wins, then the lower OAM entry.
+	void Lcd::scan_oam(const int LY, const int y_size) {
+		line_sprites_count = 0;
+		for(int sprite = 0; sprite < SPRITES && line_sprites_count < MAX_LINE_SPRITES; sprite++) {
+			if((LY >= oam[sprite].y) && (LY < oam[sprite].y + y_size)) {
+				int i = line_sprites_count++;
+				while(i > 0 && oam[line_sprites[i - 1]].x > oam[sprite].x) {
+					line_sprites[i] = line_sprites[i - 1];
+					i--;
+				}
+				line_sprites[i] = sprite;
+			}
+		}
+	}
 
-				int red = get_red_from_colorscheme(BGP, col);
-				int green = get_green_from_colorscheme(BGP, col);
-				int blue = get_blue_from_colorscheme(BGP, col);
+	// Fill sprite_line with the winning pixel of the sprites selected by the
+	// OAM scan.
+	void Lcd::draw_sprites(const int LY, const int y_size) {
+		memset(sprite_line, 0, WIDTH);
 
-                int LY = memory.read_byte(Memory::LY);
+		// Highest priority first, a pixel already taken by a sprite is kept
+		for(int i = 0; i < line_sprites_count; i++) {
+			const Sprite &sprite = oam[line_sprites[i]];
 
-                if((LY >= 0) && (LY < 144) && (pixel >= 0) && (pixel < 160)) {
-                    screen[LY][pixel][RED] = red;
-	                screen[LY][pixel][GREEN] = green;
-	                screen[LY][pixel][BLUE] = blue;
-                }
-            }
-        }
-    }
+			// Off screen sprites still count for the 10 sprites limit
+			if(sprite.x <= -8 || sprite.x >= WIDTH) {
+				continue;
+			}
 
-    void Lcd::draw_window() {
-        if(is_window_enabled()) {
-	        word tile_data = 0;
-	        word window_memory = 0;
-	        bool is_unsigned = true;
-			int LY = memory.read_byte(Memory::LY);
+			byte tile_location = sprite.tile;
+			if(y_size == 16) {
+				// Not sure pandocs says: In 8x16 sprite mode,
+				// the least significant bit of the sprite pattern number is ignored and treated as 0.
+				clear_bit(tile_location, 0);
+			}
 
-	        byte window_y = memory.read_byte(Memory::WY);
-	        byte window_x = memory.read_byte(Memory::WX) - 7;
+			int line = LY - sprite.y;
+			if(test_bit(sprite.attributes, 6)) { // y flip
+				line = y_size - 1 - line;
+			}
 
-			// FIXME: Not sure on this. It work for all games I have tested
-			if(memory.read_byte(Memory::LY) < window_y) {
-				return;
+			const byte *color_nums = tile_row(tile_location + line / 8, line % 8,
+				test_bit(sprite.attributes, 5));
+			byte flags = (get_bit(sprite.attributes, 4) + 1) << 2;
+			if(test_bit(sprite.attributes, 7)) {
+				flags |= BEHIND_BG;
 			}
 
-			if(test_bit(memory.read_byte(Memory::LCDC), 4)) {
-				tile_data = 0x8000;
-			} else {
-				tile_data = 0x8800;
-				is_unsigned = false;
+			for(int x_pix = 0; x_pix < 8; x_pix++) {
+				const int pixel = sprite.x + x_pix;
+				const byte color_num = color_nums[x_pix];
+
+				if(color_num == 0 || pixel < 0 || pixel >= WIDTH || sprite_line[pixel] != 0) {
+					continue;
+				}
+				sprite_line[pixel] = flags | color_num;
 			}
-			
-			if(test_bit(memory.read_byte(Memory::LCDC), 6)) {
-				window_memory = 0x9C00;
+		}
+	}
+
+	// Single pass compositor: the background, window and sprite lines are
+	// merged and every pixel of line_pixels is written once. The window
+	// covers the background, its color 0 too. With LCDC bit 0 clear both
+	// are blank and the sprites are drawn over white.
+	void Lcd::compose_line(const int LY) {
+		const byte lcdc = memory.read_byte(Memory::LCDC);
+		const bool blank = !test_bit(lcdc, 0);
+
+		byte background[WIDTH + 8];
+		byte window[WIDTH + 8];
+		const byte *bg = draw_background(lcdc, LY, background);
+		const int window_x = blank ? WIDTH : draw_window(lcdc, LY, window);
+		const bool sprites = line_sprites_count > 0;
+		if(sprites) {
+			draw_sprites(LY, test_bit(lcdc, 2) ? 16 : 8);
+		}
+
+		for(int pixel = 0; pixel < WIDTH; pixel++) {
+			const byte color_num = pixel >= window_x ? window[pixel - window_x] : bg[pixel];
+
+			// OBJ-to-BG Priority (0=OBJ Above BG, 1=OBJ Behind BG color 1-3)
+			// (Used for both BG and Window. BG color 0 is always behind OBJ)
+			const byte sprite = sprites ? sprite_line[pixel] : 0;
+			if(sprite != 0 && (color_num == 0 || !(sprite & BEHIND_BG))) {
+				line_pixels[pixel] = sprite & 0x0F;
 			} else {
-				window_memory = 0x9800;
+				line_pixels[pixel] = blank ? BLANK_PIXEL : color_num;
 			}
-			
-	        byte y_pos = LY - window_y;
+		}
+	}
 
-	        word tile_row = y_pos / 8 * 32;
-	        for(int pixel = window_x; pixel < WIDTH; pixel++) {
-	            byte x_pos = 0;
-	
-				if(pixel >= window_x) {
-					x_pos = pixel - window_x;
-				}
+	void Lcd::use_color_scheme(const int scheme) {
+		selected_color_scheme = scheme;
+		update_palettes();
+	}
+
+	// Rebuild the packed pixels and shades of a palette register, called by
+	// Memory when BGP, OBP0 or OBP1 is written.
+	void Lcd::update_palette(const word addr) {
+		const int palette = addr - Memory::BGP;
+		for(int color_num = 0; color_num < 4; color_num++) {
+			Color col = get_color(color_num, addr);
+			const int pixel = (palette << 2) | color_num;
+			pack_pixel(framebuffer_format, color_schemes[selected_color_scheme][palette][col], col, palettes[pixel]);
+			shades[pixel] = (palette << 2) | col;
+		}
+	}
 
-	            word tile_col = (x_pos / 8);
+	// Bytes of one pixel of a color (0xRRGGBB) with the given shade in a pixel format
+	void Lcd::pack_pixel(const int format, const int color, const int shade, byte *out) const {
+		static const byte gray[4] = { 0xFF, 0xAA, 0x55, 0x00 };
+		word rgb565;
+		switch(format) {
+		case FORMAT_RGB24:
+			out[0] = get_red(color);
+			out[1] = get_green(color);
+			out[2] = get_blue(color);
+			break;
+		case FORMAT_RGBA32:
+			out[0] = get_red(color);
+			out[1] = get_green(color);
+			out[2] = get_blue(color);
+			out[3] = 0xFF;
+			break;
+		case FORMAT_BGRA32:
+			out[0] = get_blue(color);
+			out[1] = get_green(color);
+			out[2] = get_red(color);
+			out[3] = 0xFF;
+			break;
+		case FORMAT_RGB565:
+			rgb565 = ((get_red(color) >> 3) << 11) | ((get_green(color) >> 2) << 5) | (get_blue(color) >> 3);
+			memcpy(out, &rgb565, 2);
+			break;
+		case FORMAT_GRAY8:
+			out[0] = gray[shade];
+			break;
+		}
+	}
 
-	            sword tile_num;
-	            word tile_address = window_memory + tile_row + tile_col;
+	int Lcd::bytes_per_pixel(const int format) {
+		static const int sizes[] = { 3, 4, 4, 2, 1 };
+		return sizes[format];
+	}
 
-				if(is_unsigned) {
-					tile_num = static_cast<byte>(memory.read_byte(tile_address));
-				} else {
-					tile_num = static_cast<sbyte>(memory.read_byte(tile_address));
-				}
-	            
-	            word tile_location = tile_data;
+	// Write count pixels (palette << 2 | color number, or shade | palette << 2)
+	// looked up in a table of packed pixels. Gray goes through the byte
+	// shuffle kernel, the wider pixels are copied one by one.
+	static void write_pixels(const byte *pixels, const byte table[][4], const int bpp,
+		const int count, byte *dst) {
+		switch(bpp) {
+		case 1: {
+			byte gray[16];
+			for(int i = 0; i < 16; i++) {
+				gray[i] = table[i][0];
+			}
+			map_colors(pixels, gray, count, dst);
+			break;
+		}
+		case 2:
+			for(int i = 0; i < count; i++) {
+				memcpy(dst + i * 2, table[pixels[i]], 2);
+			}
+			break;
+		case 3:
+			for(int i = 0; i < count; i++) {
+				memcpy(dst + i * 3, table[pixels[i]], 3);
+			}
+			break;
+		case 4:
+			for(int i = 0; i < count; i++) {
+				memcpy(dst + i * 4, table[pixels[i]], 4);
+			}
+			break;
+		}
+	}
 
-	           	if(is_unsigned) {
-                    tile_location += (tile_num * 16);
-                } else {
-                    tile_location += (tile_num + 128) * 16;
-                }
+	// Write the finished line to the selected output
+	void Lcd::output_line(const int LY) {
+		if(output == OUTPUT_INDEXED) {
+			map_colors(line_pixels, shades, WIDTH, buffers[back_buffer] + LY * WIDTH);
+			return;
+		}
+		const int bpp = bytes_per_pixel(framebuffer_format);
+		if(framebuffer) {
+			write_pixels(line_pixels, palettes, bpp, WIDTH, framebuffer + LY * framebuffer_pitch);
+		} else {
+			write_pixels(line_pixels, palettes, bpp, WIDTH, buffers[back_buffer] + LY * WIDTH * bpp);
+		}
+	}
 
-	            byte line = y_pos % 8;
-	            line *= 2;
+	// Called at VBlank: publish the back buffer as the latest complete frame
+	// and keep rendering in the buffer that was ready before.
+	void Lcd::swap_buffers() {
+		if(framebuffer && output == OUTPUT_RGB) {
+			// The frame is in the caller buffer already, only tell it is complete
+			ready_buffer.fetch_or(FRESH_FRAME, std::memory_order_acq_rel);
+			return;
+		}
+		last_buffer = back_buffer;
+		back_buffer = ready_buffer.exchange(back_buffer | FRESH_FRAME, std::memory_order_acq_rel) & 0x3;
+	}
 
-	            byte data1 = memory.read_byte(tile_location + line);
-	            byte data2 = memory.read_byte(tile_location + line + 1);
+	// Consumer side: take the latest complete frame, if there is a new one.
+	void Lcd::acquire_frame() {
+		front_changed = false;
+		if(ready_buffer.load(std::memory_order_acquire) & FRESH_FRAME) {
+			front_buffer = ready_buffer.exchange(front_buffer, std::memory_order_acq_rel) & 0x3;
+			front_changed = buffer_versions[front_buffer] != front_version;
+			front_version = buffer_versions[front_buffer];
+		}
+	}
 
-	            int color_bit = x_pos % 8;
-	            color_bit -= 7;
-	            color_bit *= -1;
+	/**
+	 * False if the frame returned by the last get_framebuffer()/get_frame()
+	 * is identical to the one returned before, with a caller framebuffer if
+	 * the last drawn frame is identical to the one drawn before it.
+	 */
+	bool Lcd::frame_changed() const {
+		if(framebuffer && output == OUTPUT_RGB) {
+			return last_frame_changed;
+		}
+		return front_changed;
+	}
 
-	            int color_num = get_bit(data2, color_bit);
-	            color_num <<= 1;
-	            color_num |= get_bit(data1, color_bit);
-	
-				// NOTE: Color #0 transparency in the window
-				if(color_num == 0 && !test_bit(memory.read_byte(Memory::LCDC), 1)) {
-					continue;
-				}
+	bool Lcd::is_frame_ready() const {
+		return ready_buffer.load(std::memory_order_acquire) & FRESH_FRAME;
+	}
 
-	            Color col = get_color(color_num, Memory::BGP);
+	void Lcd::set_output(const int _output) {
+		output = _output;
+		invalidate_lines();
+	}
 
-				int red = get_red_from_colorscheme(BGP, col);
-				int green = get_green_from_colorscheme(BGP, col);
-				int blue = get_blue_from_colorscheme(BGP, col);
+	// PPU_FIFO renders mid line raster effects, PPU_SCANLINE (the default)
+	// is faster. Takes effect from the next line.
+	void Lcd::set_ppu(const int _ppu) {
+		ppu = _ppu;
+		invalidate_lines();
+	}
 
-	            if((LY >= 0) && (LY < 144) && (pixel >= 0) && (pixel < 160)) {
-	                screen[LY][pixel][RED] = red;
-	                screen[LY][pixel][GREEN] = green;
-	                screen[LY][pixel][BLUE] = blue;
-	            }
-	        }
-        }
-    }
+	int Lcd::get_ppu() const {
+		return ppu;
+	}
 
-    void Lcd::draw_sprites() {
-        if(is_sprites_enabled()) {
-			bool use_8x16 = false;
-			if(test_bit(memory.read_byte(Memory::LCDC), 2)) {
-				use_8x16 = true;
-			}
-			
-			for(int sprite = 39; sprite >= 0; sprite--) {
-				byte index = sprite * 4;
-				byte y_pos = memory.read_byte(Memory::OAM + index) - 16;
-				byte x_pos = memory.read_byte(Memory::OAM + index + 1) - 8;
-				byte tile_location = memory.read_byte(Memory::OAM + index + 2);
-				byte attributes = memory.read_byte(Memory::OAM + index + 3);
-				bool bg_priority = test_bit(attributes, 7);
-
-				bool y_flip = test_bit(attributes, 6);
-				bool x_flip = test_bit(attributes, 5);
-
-				int LY = memory.read_byte(Memory::LY);
-				
-				byte y_size = 8;
-				if(use_8x16) {
-					y_size = 16;
-					// Not sure pandocs says: In 8x16 sprite mode,
-					// the least significant bit of the sprite pattern number is ignored and treated as 0.
-					clear_bit(tile_location, 0);
-				}
-				
-				if((LY >= y_pos) && (LY < (y_pos + y_size))) {
-					int line = LY - y_pos;
-					
-					if(y_flip) {
-						line -= (y_size - 1);
-						line *= -1;
-					}
-					
-					line *= 2;
-					word data_address = (Memory::VRAM + tile_location * 16) + line;
-					byte data1 = memory.read_byte(data_address);
-					byte data2 = memory.read_byte(data_address + 1);
-					
-					for(int tile_pixel = 7; tile_pixel >= 0; tile_pixel--) {
-						
-						int color_bit = tile_pixel;
-						
-						if(x_flip) {
-							color_bit -= 7;
-							color_bit *= -1;
-						}
-						
-						int color_num = get_bit(data2, color_bit);
-		                color_num <<= 1;
-		                color_num |= get_bit(data1, color_bit);
-		
-						if(color_num == 0) {
-							continue;
-						}
-
-						word color_address = test_bit(attributes, 4) ? Memory::OBP1 : Memory::OBP0;
-
-		                Color col = get_color(color_num, color_address);
-
-						int scheme_color_index = get_bit(attributes, 4) + 1;
-
-						int red = get_red_from_colorscheme(scheme_color_index, col);
-						int green = get_green_from_colorscheme(scheme_color_index, col);
-						int blue = get_blue_from_colorscheme(scheme_color_index, col);
-
-		                int x_pix = 0 - tile_pixel;
-						x_pix += 7;
-						int pixel = x_pos + x_pix;
-
-						if((LY < 0) || (LY >= 144) || (pixel < 0) || (pixel >= 160)) {
-							continue;
-		                }
-
-						// OBJ-to-BG Priority (0=OBJ Above BG, 1=OBJ Behind BG color 1-3)
-						// (Used for both BG and Window. BG color 0 is always behind OBJ)
-						if(bg_priority && (background_color(LY, pixel) != WHITE)) {
-							continue;
-						}
-
-						screen[LY][pixel][RED] = red;
-		                screen[LY][pixel][GREEN] = green;
-		                screen[LY][pixel][BLUE] = blue;
-					}
-				}
-			}
-        }
-    }
+	// Draw one frame out of frames + 1, applied from the next VBlank.
+	// Skipped frames are not published, the last drawn frame stays.
+	void Lcd::set_frameskip(const int frames) {
+		frameskip = frames < 0 ? 0 : frames;
+	}
 
-	// FIXME: This code could be better
-	Color Lcd::background_color(const int x, const int y) const {
-		int hexcolor = rgb_to_hex(screen[x][y][RED], screen[x][y][GREEN], screen[x][y][BLUE]);
-		for(int i = 0; i < 3; i++) {
-			if(color_schemes[selected_color_scheme][BGP][i] == hexcolor) {
-				return color_indexes[i];
+	int Lcd::get_frameskip() const {
+		return frameskip;
+	}
+
+	// Render straight into a caller buffer of HEIGHT rows of pitch bytes,
+	// or, with a null buffer, into the internal triple buffers in format.
+	void Lcd::set_framebuffer(byte *pixels, const int format, const int pitch) {
+		framebuffer = pixels;
+		framebuffer_format = format;
+		framebuffer_pitch = pitch;
+		ready_buffer.fetch_and(~FRESH_FRAME, std::memory_order_acq_rel);
+		update_palettes();
+	}
+
+	// Latest complete frame in the framebuffer format. Only one consumer
+	// (thread) may call this, the frame stays valid until its next call.
+	// A caller framebuffer is returned as is, the frame is taken.
+	const byte *Lcd::get_framebuffer() {
+		if(framebuffer) {
+			if(output == OUTPUT_RGB) {
+				ready_buffer.fetch_and(~FRESH_FRAME, std::memory_order_acq_rel);
 			}
+			return framebuffer;
 		}
-		// TODO: Throw an exception here.
+		acquire_frame();
+		return buffers[front_buffer];
 	}
 
-	void Lcd::use_color_scheme(const int scheme) {
-		selected_color_scheme = scheme;
+	// Bytes per row of the frames get_framebuffer() returns
+	int Lcd::get_framebuffer_pitch() const {
+		if(framebuffer) {
+			return framebuffer_pitch;
+		}
+		return output == OUTPUT_INDEXED ? WIDTH : WIDTH * bytes_per_pixel(framebuffer_format);
+	}
+
+	// Latest complete indexed frame, same rules as get_framebuffer().
+	const byte *Lcd::get_frame() {
+		acquire_frame();
+		return buffers[front_buffer];
+	}
+
+	// Late palette resolution of the latest indexed frame, the color scheme
+	// is applied only here.
+	void Lcd::convert_frame(const int format, byte *dst, const int pitch) {
+		acquire_frame();
+		byte table[16][4] = {{0}};
+		for(int pixel = 0; pixel < 12; pixel++) {
+			const int shade = pixel & 0x3;
+			pack_pixel(format, color_schemes[selected_color_scheme][pixel >> 2][shade], shade, table[pixel]);
+		}
+		for(int y = 0; y < HEIGHT; y++) {
+			write_pixels(buffers[front_buffer] + y * WIDTH, table, bytes_per_pixel(format), WIDTH, dst + y * pitch);
+		}
+	}
+
+	void Lcd::update_palettes() {
+		invalidate_lines();
+		update_palette(Memory::BGP);
+		update_palette(Memory::OBP0);
+		update_palette(Memory::OBP1);
+		pack_pixel(framebuffer_format, color_schemes[selected_color_scheme][BGP][WHITE], WHITE, palettes[BLANK_PIXEL]);
+		shades[BLANK_PIXEL] = (BGP << 2) | WHITE;
 	}
 
 	Color Lcd::get_color(const byte index, const word addr) const {
-	    Color color;
 	    byte palette = memory.read_byte(addr);
 		int color_index = (palette >> (index * 2)) & 0x3;
 		return color_indexes[color_index];
 	}
 	
-	inline int Lcd::rgb_to_hex(const byte r, const byte g, const byte b) const {
-		return ((r << 16) | (g << 8) | b) & 0xFFFFFF;
-	}
-
 	inline byte Lcd::get_red(const int hexcolor) const {
 		return (hexcolor >> 16) & 0xFF;
 	}
@@ -459,19 +941,111 @@ namespace gbpp {
 		return hexcolor & 0xFF;
 	}
 	
-	inline byte Lcd::get_red_from_colorscheme(const int scheme_color_index, const int color) const {
-		int hexcolor = color_schemes[selected_color_scheme][scheme_color_index][color];
-		return get_red(hexcolor);
+	/**
+	 * The line and FIFO state, the last published frame and the lines of
+	 * the current one drawn so far. Frames drawn in a caller framebuffer
+	 * are not saved. The OAM copy is decoded again from the memory.
+	 */
+	void Lcd::save_state(StateWriter &state) const {
+		state.put(mode);
+		state.put(static_cast<int>(memory.read_byte(Memory::LY)));
+		state.put(mode_cycles);
+		state.put(ppu);
+		state.put(line_sprites);
+		state.put(line_sprites_count);
+		state.put(bg_fifo);
+		state.put(bg_head);
+		state.put(bg_count);
+		for(int i = 0; i < 8; i++) {
+			state.put(obj_fifo[i].color);
+			state.put(obj_fifo[i].flags);
+		}
+		state.put(obj_head);
+		state.put(fetch_step);
+		state.put(fetch_x);
+		state.put(fetching_window);
+		state.put(window_drawn);
+		state.put(window_y_reached);
+		state.put(window_line);
+		state.put(line_x);
+		state.put(discard);
+		state.put(next_sprite);
+		state.put(sprite_stall);
+		state.put(penalty_column);
+		state.put(fifo_dots);
+		state.put(skipped_frames);
+		state.put(skip_frame);
+		state.put(last_buffer != back_buffer); // a frame was published
+		state.put(buffers[last_buffer]);
+		state.put(buffers[back_buffer]);
 	}
 
-	inline byte Lcd::get_green_from_colorscheme(const int scheme_color_index, const int color) const {
-		int hexcolor = color_schemes[selected_color_scheme][scheme_color_index][color];
-		return get_green(hexcolor);
-	}
+	/**
+	 * Everything used as an index is checked. The memory is loaded before,
+	 * the caches are rebuilt from it. The saved last frame is published
+	 * again, as a new frame.
+	 */
+	void Lcd::load_state(StateReader &state) {
+		const int saved_mode = state.read<int>(MODE_0, MODE_3);
+		const int line = state.read<int>(0, VBLANK_MAX);
+		state.check(saved_mode == MODE_1 || line < HEIGHT);
+		state.get(mode_cycles, -HBLANK, HBLANK);
+		state.get(ppu, PPU_SCANLINE, PPU_FIFO);
+		for(int i = 0; i < MAX_LINE_SPRITES; i++) {
+			state.get(line_sprites[i], 0, SPRITES - 1);
+		}
+		state.get(line_sprites_count, 0, MAX_LINE_SPRITES);
+		for(int i = 0; i < 8; i++) {
+			state.get(bg_fifo[i], 0, 3);
+		}
+		state.get(bg_head, 0, 7);
+		state.get(bg_count, 0, 8);
+		for(int i = 0; i < 8; i++) {
+			state.get(obj_fifo[i].color, 0, 3);
+			const byte flags = state.read<byte>(0, BEHIND_BG | 0x0C);
+			state.check((flags & ~(BEHIND_BG | 0x0C)) == 0 && (flags & 0x0C) != 0x0C);
+			if(state.is_applying()) {
+				obj_fifo[i].flags = flags;
+			}
+		}
+		state.get(obj_head, 0, 7);
+		state.get(fetch_step, -7, 6);
+		state.get(fetch_x, 0, 255);
+		state.get(fetching_window);
+		state.get(window_drawn);
+		state.get(window_y_reached);
+		state.get(window_line, 0, INT_MAX);
+		state.get(line_x, 0, WIDTH);
+		state.get(discard, 0, 7);
+		state.get(next_sprite, 0, MAX_LINE_SPRITES);
+		state.get(sprite_stall, 0, 11);
+		state.get(penalty_column);
+		state.get(fifo_dots, 0, HBLANK);
+		state.get(skipped_frames, 0, INT_MAX);
+		state.get(skip_frame);
+		bool published = false;
+		state.get(published);
+		state.get(buffers[back_buffer]);
+		if(published) {
+			buffer_versions[back_buffer] = ++frame_version;
+			swap_buffers();
+		}
+		state.get(buffers[back_buffer]);
+		if(!state.is_applying()) {
+			return;
+		}
 
-	inline byte Lcd::get_blue_from_colorscheme(const int scheme_color_index, const int color) const {
-		int hexcolor = color_schemes[selected_color_scheme][scheme_color_index][color];
-		return get_blue(hexcolor);
+		mode = saved_mode;
+		memory.set_ly(line);
+		for(int i = 0; i < SPRITES * 4; i++) {
+			update_oam(Memory::OAM + i, memory.read_byte(Memory::OAM + i));
+		}
+		invalidate_tiles();
+		update_palettes();
+		frame_dirty = true;
+		if(mode == MODE_3 && ppu == PPU_FIFO) {
+			set_fifo_line(line);
+		}
 	}
 
     Lcd& Lcd::get_instance() {
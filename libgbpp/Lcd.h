@@ -19,9 +19,12 @@
 #ifndef _LCD_H_
 #define _LCD_H_
 
+#include <atomic>
+
 #include "types.h"
 #include "util.h"
 #include "Components.h"
+#include "State.h"
 
 namespace gbpp {
 	enum Color {
@@ -94,58 +97,240 @@ namespace gbpp {
 	};
 
 	class Lcd {
+	public:
+		static const int WIDTH  = 160;
+		static const int HEIGHT = 144;
+		
+		static const int VBLANK_MAX = 153;
+		static const int HBLANK     = 456; // cycles of a line
+		static const int VBLANK = 144;
+		
+		static const int CYCLES_MODE0 = 204; // HBlank
+		static const int CYCLES_MODE1 = 456; // every VBlank line
+		static const int CYCLES_MODE2 =  80; // OAM scan
+		static const int CYCLES_MODE3 = 172; // pixel transfer
+
+		enum {
+			OUTPUT_RGB,    // framebuffer, colors of the selected color scheme
+			OUTPUT_INDEXED // frame, shade | palette << 2
+		};
+
+		enum {
+			PPU_SCANLINE, // whole line at the end of mode 3 (fast, default)
+			PPU_FIFO      // dot clock pixel FIFO, mid line register changes
+		};
+
+		enum {
+			FORMAT_RGB24,
+			FORMAT_RGBA32,
+			FORMAT_BGRA32, // 0xAARRGGBB in little endian
+			FORMAT_RGB565,
+			FORMAT_GRAY8
+		};
+		
 	private:
 		enum { MODE_0, MODE_1, MODE_2, MODE_3 };
 		enum { BGP, OBP0, OBP1 };
 		enum { RED, GREEN, BLUE };
 		
 		Lcd();
-		int scanline_counter;
+		static const int TILES = 384; // 0x8000-0x97FF
+		static const int SPRITES = 40;
+		static const int MAX_LINE_SPRITES = 10;
+
+		// OAM entry, position already translated to screen coordinates
+		struct Sprite {
+			int y;
+			int x;
+			byte tile;
+			byte attributes;
+		};
+
+		int mode;
+		int mode_cycles; // cycles left until the next mode transition
 		int selected_color_scheme;
-		void reset_scanline_counter();
-		void clear_screen();
-		byte get_current_mode() const;
-		bool is_background_enabled() const;
-		bool is_window_enabled() const;
-		bool is_sprites_enabled() const;
-		void draw_background();
-		void draw_window();
-		void draw_sprites();
-		void scanline();
+
+		// Tile cache: every tile decoded to color numbers, plus the
+		// horizontally flipped version used by sprites.
+		byte tile_cache[TILES][8][8];
+		byte tile_cache_flipped[TILES][8][8];
+		bool dirty_tiles[TILES];
+
+		// Dirty lines: versions of the tiles and of the tile map rows (32
+		// bytes, both maps), bumped when the data really changes.
+		static const int MAP_ROWS = 64;
+		dword tile_versions[TILES];
+		dword map_versions[MAP_ROWS];
+
+		// Everything a line depends on. The tiles are summed, the versions
+		// only grow and the set of tiles is fixed by the registers and maps.
+		struct LineKey {
+			byte registers[8]; // LCDC, SCY, SCX, WY, WX, BGP, OBP0, OBP1
+			dword maps;
+			dword tiles;
+			dword sprites[MAX_LINE_SPRITES]; // x, tile, line and flags
+			int sprites_count;
+		};
+
+		// Keys of the lines of the last drawn frame, a line with the same key
+		// is copied from it (or left alone in a caller buffer).
+		LineKey line_keys[HEIGHT];
+		bool valid_lines[HEIGHT];
+
+		// Unchanged frame detection: frames with a changed line get a new
+		// version, the consumer compares the versions of the frames it takes.
+		bool frame_dirty;
+		bool last_frame_changed;
+		dword frame_version;
+		dword buffer_versions[3];
+		dword front_version;
+		bool front_changed;
+
+		// Packed pixel (in the framebuffer format) and shade of each color
+		// number for BGP, OBP0 and OBP1, indexed by palette << 2 | color number.
+		// Rebuilt when a palette register is written, the color scheme or
+		// the framebuffer changes.
+		byte palettes[16][4];
+		byte shades[16];
+
+		// Background and window off (LCDC bit 0 clear): white, whatever BGP is
+		static const byte BLANK_PIXEL = 12;
+
+		// Winning sprite pixel of every pixel of the current line, 0 for none,
+		// else palette << 2 | color number, plus BEHIND_BG for OBJ-to-BG priority.
+		static const byte BEHIND_BG = 0x80;
+		byte sprite_line[WIDTH];
+
+		// Finished line, palette << 2 | color number
+		byte line_pixels[WIDTH];
+
+		// Decoded copy of the OAM and the sprites selected for the current line
+		Sprite oam[SPRITES];
+		int line_sprites[MAX_LINE_SPRITES];
+		int line_sprites_count;
+
+		int output;
+		int ppu;
+
+		// Pixel FIFO PPU, state of the line in mode 3. The background fetcher
+		// takes 6 dots per tile and pushes 8 pixels when the FIFO is empty,
+		// one pixel is shifted out per dot. Sprite fetches stall both.
+		struct ObjPixel {
+			byte color;
+			byte flags; // palette << 2 | BEHIND_BG
+		};
+		byte bg_fifo[8];
+		int bg_head;
+		int bg_count;
+		ObjPixel obj_fifo[8];
+		int obj_head;
+		int fetch_step;  // dots of the current tile fetch, negative at line start
+		int fetch_x;     // tile column of the next fetch
+		bool fetching_window;
+		bool window_drawn;
+		bool window_y_reached; // LY was WY in this frame
+		int window_line; // internal window line counter
+		int line_x;      // next pixel of the line
+		int discard;     // pixels to drop, fine scroll
+		int next_sprite; // in line_sprites
+		int sprite_stall;
+		int penalty_column; // tile column that paid the sprite alignment penalty
+		int fifo_dots;   // length of mode 3 so far
+		byte *fifo_line; // where the pixels go, null on skipped frames
+		int fifo_bpp;
+
+		// Frame skipping: after a drawn frame the next frameskip frames only
+		// run the timing, STAT and interrupts, no pixel is generated.
+		int frameskip;
+		int skipped_frames;
+		bool skip_frame; // current frame is not drawn
+
+		// Frames are triple buffered: lines are rendered in the back buffer,
+		// at VBlank it becomes the ready buffer and a consumer (may be on
+		// another thread) swaps the latest ready buffer for its front buffer.
+		// The handoff is a single atomic exchange in each side.
+		static const int FRESH_FRAME = 4;
+		byte buffers[3][HEIGHT * WIDTH * 4];
+		int back_buffer;  // emulation side
+		int last_buffer;  // emulation side, last published frame
+		int front_buffer; // consumer side
+		std::atomic<int> ready_buffer; // index | FRESH_FRAME
+
+		// Caller buffer for OUTPUT_RGB, null to render in the buffers above
+		byte *framebuffer;
+		int framebuffer_format;
+		int framebuffer_pitch;
+
+		int tile_index(const byte lcdc, const byte tile_num) const;
+		void decode_tile(const int tile);
+		const byte *tile_row(const int tile, const int line, const bool x_flip);
+		void invalidate_tiles();
+		void invalidate_lines();
+		bool update_line_key(const byte lcdc, const int LY);
+		void copy_line(const int LY);
+		void draw_line(const int LY);
+		void start_fifo_line(const int LY);
+		void set_fifo_line(const int LY);
+		int step_fifo(const int dots);
+		void fetch_fifo_tile();
+		void fetch_fifo_sprite();
+		void push_fifo_pixel(const byte pixel);
+		void fetch_tile_line(const word map_row, const byte lcdc, const int line,
+			const int tile_col, const int count, byte *out);
+		void update_palettes();
+		void scan_oam(const int LY, const int y_size);
+		void output_line(const int LY);
+		void swap_buffers();
+		void acquire_frame();
+		void pack_pixel(const int format, const int color, const int shade, byte *out) const;
+		const byte *draw_background(const byte lcdc, const int LY, byte *colors);
+		int draw_window(const byte lcdc, const int LY, byte *colors);
+		void draw_sprites(const int LY, const int y_size);
+		void compose_line(const int LY);
+		void next_mode();
+		void set_mode(const int _mode);
+		void next_line();
+		void start_vblank();
 		Color get_color(const byte color_num, const word addr) const;
-		Color background_color(const int x, const int y) const;
-		int rgb_to_hex(const byte r, const byte g, const byte b) const;
 		byte get_red(const int hexcolor) const;
 		byte get_green(const int hexcolor) const;
 		byte get_blue(const int hexcolor) const;
-		byte get_red_from_colorscheme(const int scheme_color_index, const int color) const;
-		byte get_green_from_colorscheme(const int scheme_color_index, const int color) const;
-		byte get_blue_from_colorscheme(const int scheme_color_index, const int color) const;
 		
 	public:
-		static const int WIDTH  = 160;
-		static const int HEIGHT = 144;
-		
-		static const int VBLANK_MAX = 153;
-		static const int HBLANK     = 456;
-		static const int VBLANK = 144;
-		
-		static const int CYCLES_MODE0 = 375;
-		static const int CYCLES_MODE1 = 456;
-		static const int CYCLES_MODE2 =  82;
-		static const int CYCLES_MODE3 = 172;
-		
-		// TODO: This must be private, I need find a way to make an get for this attribute
-		// The buffer could be an Array with 144*160 positions or
-		// an Array [144][160]=0xFFFF
-		// those ways is easier to encapsulate
-		byte screen[HEIGHT][WIDTH][3];
-		
 		void use_color_scheme(const int scheme);
+		void set_output(const int _output);
+		void set_ppu(const int _ppu);
+		int get_ppu() const;
+		void set_frameskip(const int frames);
+		int get_frameskip() const;
+		void set_framebuffer(byte *pixels, const int format, const int pitch);
+		const byte *get_framebuffer();
+		int get_framebuffer_pitch() const;
+		const byte *get_frame();
+		bool is_frame_ready() const;
+		void convert_frame(const int format, byte *dst, const int pitch);
+		static int bytes_per_pixel(const int format);
+		void invalidate_tile(const word addr);
+		void invalidate_map(const word addr);
+		bool frame_changed() const;
+		void update_palette(const word addr);
+		void update_oam(const word addr, const byte data);
 		void reset();
-		void set_lcd_status();
+		void save_state(StateWriter &state) const;
+		void load_state(StateReader &state);
+		void update_coincidence();
+		void switch_lcd(const bool on);
 		bool is_lcd_enabled() const;
-		void update_graphics(const int cycles);
+
+		// Called after every instruction, it only counts the cycles down
+		// until the next mode transition.
+		void update_graphics(const int cycles) {
+			mode_cycles -= cycles;
+			if(mode_cycles <= 0) {
+				next_mode();
+			}
+		}
+
 		static Lcd& get_instance();
 	};
 }
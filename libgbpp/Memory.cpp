@@ -16,9 +16,11 @@
  *   along with this program. If not, see <http://www.gnu.org/licences>
  */
 
+#include <cstring>
 #include "Memory.h"
 #include "Cartridge.h"
 #include "Lcd.h"
+#include "Apu.h"
 
 namespace gbpp {
 	
@@ -31,36 +33,16 @@ namespace gbpp {
 	void Memory::reset(const bool _skip_bios) {
 		current_rom_bank = 1;
 		current_ram_bank = 0;
-		joypad_state = 0xFF;
 		mbc_mode = 0;
 		skip_bios = _skip_bios;
 
 		// Special registers
 		// If using Bios, it is not necessary set this registers
 		// Because Bios does this.
-		ram[P1]    = 0xFF;
 		ram[DIV]   = 0xAF;
 		ram[TIMA]  = 0x00;
 		ram[TMA]   = 0x00;
 		ram[TAC]   = 0x00;
-		ram[NR_10] = 0x80;
-		ram[NR_11] = 0xBF;
-		ram[NR_12] = 0xF3;
-		ram[NR_14] = 0xBF;
-		ram[NR_21] = 0x3F;
-		ram[NR_22] = 0x00;
-		ram[NR_24] = 0xBF;
-		ram[NR_30] = 0x7F;
-		ram[NR_31] = 0xFF;
-		ram[NR_32] = 0x9F;
-		ram[NR_34] = 0xBF;
-		ram[NR_41] = 0xFF;
-		ram[NR_42] = 0x00;
-		ram[NR_43] = 0x00;
-		ram[NR_44] = 0xBF;
-		ram[NR_50] = 0x77;
-		ram[NR_51] = 0xF3;
-		ram[NR_52] = 0xF1;
 		ram[LCDC]  = 0x91;
 		ram[SCY]   = 0x00;
 		ram[SCX]   = 0x00;
@@ -72,10 +54,9 @@ namespace gbpp {
 		ram[WX]    = 0x00;
 		ram[IE]    = 0x00;
 		
-		// Awesome!! Bios initialize this too :)
-		for (int i = 0; i < 0x2000; i++) {
-			eram[i] = cartridge.read_byte(0xA000 + i);
-		}
+		// External RAM starts cleared, 0xA000-0xBFFF is not in the rom
+		// (reading it there went past the end of 32KB roms)
+		memset(eram, 0, sizeof(eram));
 	}
 
 	byte Memory::read_byte(const word addr) {
@@ -100,9 +81,12 @@ namespace gbpp {
 		case 0xB000:
 			return eram[(addr - 0xA000) + (current_ram_bank * 0x2000)];
 		case 0xF000:
+			if(addr >= Apu::FIRST_REGISTER && addr <= Apu::LAST_REGISTER) {
+				return apu.read_register(addr);
+			}
 			switch(addr & 0x0FFF) {
 			case 0xF00:
-				return joypad_mem_state();
+				return joypad.read();
 			}
 		}
 		return ram[addr];
@@ -136,6 +120,7 @@ namespace gbpp {
 
 	void Memory::write_byte(const word addr, const byte data) {
 		byte current_clock_freq;
+		byte current_lcdc;
 		
 		// This area is prohibited.
 		if (((addr >= 0xFEA0) && (addr < 0xFF00)) || ((addr >= 0xFF4C) && (addr < 0xFF80))) {
@@ -159,6 +144,17 @@ namespace gbpp {
 				eram[(addr - 0xA000) + (current_ram_bank * 0x2000)] = data;
 			}
 			break;
+		case 0x8000:
+		case 0x9000:
+			if(ram[addr] != data) {
+				ram[addr] = data;
+				if(addr < BTM0) { // tile data
+					lcd.invalidate_tile(addr);
+				} else {
+					lcd.invalidate_map(addr);
+				}
+			}
+			break;
 		case 0xC000:
 		case 0xD000:
 			ram[addr] = data;
@@ -168,6 +164,16 @@ namespace gbpp {
 			ram[addr - 0x2000] = data;
 			break;
 		case 0xF000:
+			if((addr & 0xFF00) == OAM) {
+				ram[addr] = data;
+				lcd.update_oam(addr, data);
+				break;
+			}
+			if(addr >= Apu::FIRST_REGISTER && addr <= Apu::LAST_REGISTER) {
+				ram[addr] = data;
+				apu.write_register(addr, data);
+				break;
+			}
 			switch(addr & 0x0FFF) {
 			case 0xA00:
 			case 0xB00:
@@ -176,6 +182,9 @@ namespace gbpp {
 				ram[addr] = data;
 				ram[addr - 0x2000] = data;
 				break;
+			case 0xF00: // P1
+				joypad.write(data);
+				break;
 			case 0xF04: // DIV
 				cpu.reset_divider_counter();
 				ram[addr] = 0;
@@ -190,11 +199,28 @@ namespace gbpp {
 			case 0xF46: // DMA
 				dma_transfer(data);
 				break;
+			case 0xF40: // LCDC
+				current_lcdc = ram[addr];
+				ram[addr] = data;
+				if(test_bit(current_lcdc ^ data, 7)) {
+					lcd.switch_lcd(test_bit(data, 7));
+				}
+				break;
+			case 0xF41: // STAT, mode and coincidence bits are read only
+				ram[addr] = (data & 0x78) | (ram[addr] & 0x07);
+				break;
 			case 0xF44: // LY
 				ram[addr] = 0;
 				break;
 			case 0xF45: // LYC
 				ram[addr] = data;
+				lcd.update_coincidence();
+				break;
+			case 0xF47: // BGP
+			case 0xF48: // OBP0
+			case 0xF49: // OBP1
+				ram[addr] = data;
+				lcd.update_palette(addr);
 				break;
 			case 0xF0F: // IF
 				ram[addr] = data & 0x1F;
@@ -251,36 +277,26 @@ namespace gbpp {
 		}*/
 	}
 	
-	byte Memory::get_joypad_state() {
-		return joypad_state;
-	}
-	
-	void Memory::set_joypad_state(const byte key) {
-		set_bit(joypad_state, key);
-	}
-	
-	void Memory::clear_joypad_state(const byte key) {
-		clear_bit(joypad_state, key);
+	// Direct access to the video RAM, used by the Lcd to fetch a whole line
+	// of tiles without dispatching every byte through read_byte.
+	const byte *Memory::get_vram() {
+		return &ram[VRAM];
 	}
 	
-	byte Memory::joypad_mem_state() const {
-		byte res = ram[P1];
-		
-		res ^= 0xFF; // Flip all bits
-		
-		// buttons
-		if(!(test_bit(res, 4))) {
-			byte top_joypad = joypad_state >> 4;
-			top_joypad |= 0xF0; // turn the top 4 bits on
-			res &= top_joypad;
-		} else if(!(test_bit(res, 5))) {
-			byte bottom_joypad = joypad_state & 0xF;
-			bottom_joypad |= 0xF0;
-			res &= bottom_joypad;
+	/**
+	 * Direct access for scripted readers: video RAM, internal RAM, OAM and
+	 * the registers (0x8000-0xFFFF, P1 and the sound registers live in
+	 * their components), the current bank for external RAM, 0 for the ROM.
+	 */
+	const byte *Memory::get_pointer(const word addr) {
+		if(addr < VRAM) {
+			return 0;
+		} else if(addr >= RAM1 && addr < RAM0) {
+			return &eram[(addr - RAM1) + (current_ram_bank * 0x2000)];
 		}
-		return res;
+		return &ram[addr];
 	}
-	
+
 	void Memory::dma_transfer(const byte data) {
 		word addr = (data * 0x100);
 		for(int i = 0; i < 0xA0; i++) {
@@ -409,11 +425,41 @@ namespace gbpp {
 	void Memory::increment_ly() {
 		ram[LY]++;
 	}
+
+	void Memory::set_ly(const byte value) {
+		ram[LY] = value;
+	}
+
+	// STAT with the read only bits (mode and coincidence), for the Lcd
+	void Memory::set_lcd_status(const byte status) {
+		ram[STAT] = status;
+	}
 	
 	void Memory::increment_div() {
 		ram[DIV]++;
 	}
 	
+	// 0x8000-0xFFFF, the cartridge RAM and the banking
+	void Memory::save_state(StateWriter &state) {
+		state.put_bytes(&ram[VRAM], 0x8000);
+		state.put(eram);
+		state.put(skip_bios);
+		state.put(eram_enabled);
+		state.put(mbc_mode);
+		state.put(current_rom_bank);
+		state.put(current_ram_bank);
+	}
+
+	void Memory::load_state(StateReader &state) {
+		state.get_bytes(&ram[VRAM], 0x8000);
+		state.get(eram);
+		state.get(skip_bios);
+		state.get(eram_enabled);
+		state.get(mbc_mode, 0, 1);
+		state.get(current_rom_bank, 0, 0x7F); // any bank the MBC registers select
+		state.get(current_ram_bank, 0, static_cast<int>(sizeof(eram) / ROM_BANK_SIZE) - 1);
+	}
+
 	Memory& Memory::get_instance() {
 		static Memory inst;
 		return inst;
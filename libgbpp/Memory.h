@@ -27,6 +27,7 @@ using std::string;
 #include <iomanip>
 #include <cassert>
 #include "types.h"
+#include "State.h"
 
 namespace gbpp {
 	
@@ -134,25 +135,26 @@ namespace gbpp {
 		void increment_tima();
 		void increment_div();
 		void increment_ly();
+		void set_ly(const byte value);
+		void set_lcd_status(const byte status);
 		void dma_transfer(const byte data);
+		const byte *get_vram();
+		const byte *get_pointer(const word addr);
+		void save_state(StateWriter &state);
+		void load_state(StateReader &state);
 		void reset();
 		void reset(const bool _skip_bios);
-		byte get_joypad_state();
-		void set_joypad_state(const byte key);
-		void clear_joypad_state(const byte key);
 		static Memory& get_instance();
 	private:
 		Memory();
 		InternalRam ram; // addresses >= 0x8000
 		byte eram[ROM_BANK_SIZE * 4]; // external RAM
-		byte joypad_state;
 		bool skip_bios;
 		bool eram_enabled;
 		int mbc_mode;
 		byte current_rom_bank;
 		byte current_ram_bank;
 		void mbc_switch(const word addr, byte data);
-		byte joypad_mem_state() const;
 	};
 
 }
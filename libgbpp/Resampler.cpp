@@ -0,0 +1,271 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include <cmath>
+#include <cstring>
+#include "Resampler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GBPP_X86
+#include <immintrin.h>
+#endif
+
+namespace gbpp {
+
+	// One output sample: TAPS input samples of each side times the
+	// coefficients of the phase, interpolated with the next phase by frac.
+	typedef void (*DotKernel)(const float *, const float *, const float *, const float *,
+		const float, float *);
+
+	struct ResamplerKernel {
+		DotKernel dot;
+		const char *name;
+	};
+
+	static const int HALF = Resampler::TAPS / 2;
+	static const int PHASE_SHIFT = 32 - 8; // PHASES = 256
+	static const double KAISER_BETA = 7.5;  // about 75 dB stop band
+
+	static void dot_scalar(const float *left, const float *right, const float *c0, const float *c1,
+			const float frac, float *out) {
+		float l = 0;
+		float r = 0;
+		for(int i = 0; i < Resampler::TAPS; i++) {
+			const float c = c0[i] + frac * (c1[i] - c0[i]);
+			l += c * left[i];
+			r += c * right[i];
+		}
+		out[0] = l;
+		out[1] = r;
+	}
+
+#ifdef GBPP_X86
+	// [l0 l1 l2 l3], [r0 r1 r2 r3] to the two sums
+	__attribute__((target("sse2")))
+	static inline void store_sums(const __m128 l, const __m128 r, float *out) {
+		__m128 sums = _mm_add_ps(_mm_unpacklo_ps(l, r), _mm_unpackhi_ps(l, r));
+		sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+		out[0] = _mm_cvtss_f32(sums);
+		out[1] = _mm_cvtss_f32(_mm_shuffle_ps(sums, sums, 1));
+	}
+
+	__attribute__((target("sse2")))
+	static void dot_sse2(const float *left, const float *right, const float *c0, const float *c1,
+			const float frac, float *out) {
+		const __m128 f = _mm_set1_ps(frac);
+		__m128 l = _mm_setzero_ps();
+		__m128 r = _mm_setzero_ps();
+		for(int i = 0; i < Resampler::TAPS; i += 4) {
+			const __m128 a = _mm_load_ps(c0 + i);
+			const __m128 c = _mm_add_ps(a, _mm_mul_ps(f, _mm_sub_ps(_mm_load_ps(c1 + i), a)));
+			l = _mm_add_ps(l, _mm_mul_ps(c, _mm_loadu_ps(left + i)));
+			r = _mm_add_ps(r, _mm_mul_ps(c, _mm_loadu_ps(right + i)));
+		}
+		store_sums(l, r, out);
+	}
+
+	__attribute__((target("avx2")))
+	static void dot_avx2(const float *left, const float *right, const float *c0, const float *c1,
+			const float frac, float *out) {
+		const __m256 f = _mm256_set1_ps(frac);
+		__m256 l = _mm256_setzero_ps();
+		__m256 r = _mm256_setzero_ps();
+		for(int i = 0; i < Resampler::TAPS; i += 8) {
+			const __m256 a = _mm256_load_ps(c0 + i);
+			const __m256 c = _mm256_add_ps(a, _mm256_mul_ps(f, _mm256_sub_ps(_mm256_load_ps(c1 + i), a)));
+			l = _mm256_add_ps(l, _mm256_mul_ps(c, _mm256_loadu_ps(left + i)));
+			r = _mm256_add_ps(r, _mm256_mul_ps(c, _mm256_loadu_ps(right + i)));
+		}
+		store_sums(_mm_add_ps(_mm256_castps256_ps128(l), _mm256_extractf128_ps(l, 1)),
+			_mm_add_ps(_mm256_castps256_ps128(r), _mm256_extractf128_ps(r, 1)), out);
+	}
+#endif
+
+	static ResamplerKernel select_resampler_kernel() {
+		ResamplerKernel kernel = { dot_scalar, "scalar" };
+#ifdef GBPP_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			ResamplerKernel avx2 = { dot_avx2, "avx2" };
+			kernel = avx2;
+		} else if(__builtin_cpu_supports("sse2")) {
+			ResamplerKernel sse2 = { dot_sse2, "sse2" };
+			kernel = sse2;
+		}
+#endif
+		return kernel;
+	}
+
+	static const ResamplerKernel &resampler_kernel() {
+		static const ResamplerKernel kernel = select_resampler_kernel();
+		return kernel;
+	}
+
+	const char *resampler_kernels() {
+		return resampler_kernel().name;
+	}
+
+	static inline short to_sample(const float value) {
+		const float rounded = value < 0 ? value - 0.5f : value + 0.5f;
+		if(rounded <= -32768) {
+			return -32768;
+		} else if(rounded >= 32767) {
+			return 32767;
+		}
+		return static_cast<short>(rounded);
+	}
+
+	// Modified Bessel function of the first kind, order 0
+	static double bessel_i0(const double x) {
+		double sum = 1;
+		double term = 1;
+		for(int k = 1; k < 32; k++) {
+			term *= (x / (2 * k)) * (x / (2 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	/**
+	 * scalar: always use the reference kernel (to compare the SIMD ones
+	 * with it), otherwise the fastest one the cpu has.
+	 */
+	Resampler::Resampler(const bool scalar) : kernel(scalar ? dot_scalar : resampler_kernel().dot),
+			input_rate(1), output_rate(1), ratio(1) {
+		set_rates(1, 1);
+	}
+
+	// The filter is centered at 45% of the lower rate, what is left above
+	// the output Nyquist frequency folds back above 19 kHz at 44.1 kHz
+	void Resampler::set_rates(const double _input_rate, const double _output_rate) {
+		input_rate = _input_rate;
+		output_rate = _output_rate;
+		build_coefficients();
+		update_step();
+		clear();
+	}
+
+	/**
+	 * Make ratio times more output samples than the rates say (rate
+	 * control), the filter is not changed and nothing is dropped.
+	 */
+	void Resampler::set_ratio(const double _ratio) {
+		ratio = _ratio;
+		update_step();
+	}
+
+	double Resampler::get_ratio() const {
+		return ratio;
+	}
+
+	void Resampler::update_step() {
+		step = static_cast<unsigned long long>(input_rate / (output_rate * ratio) * 4294967296.0 + 0.5);
+	}
+
+	void Resampler::build_coefficients() {
+		const double pi = 3.14159265358979323846;
+		const double lower_rate = input_rate < output_rate ? input_rate : output_rate;
+		const double cutoff = 0.45 * lower_rate / input_rate;
+		for(int phase = 0; phase <= PHASES; phase++) {
+			double taps[TAPS];
+			double sum = 0;
+			for(int i = 0; i < TAPS; i++) {
+				const double x = i - (HALF - 1) - static_cast<double>(phase) / PHASES;
+				const double sinc = x == 0 ? 1 : sin(2 * pi * cutoff * x) / (2 * pi * cutoff * x);
+				const double t = x / HALF;
+				const double window = t * t < 1 ? bessel_i0(KAISER_BETA * sqrt(1 - t * t)) / bessel_i0(KAISER_BETA) : 0;
+				taps[i] = sinc * window;
+				sum += taps[i];
+			}
+			for(int i = 0; i < TAPS; i++) {
+				coefficients[phase][i] = static_cast<float>(taps[i] / sum);
+			}
+		}
+	}
+
+	// Drop everything, the next input starts after HALF - 1 samples of silence
+	void Resampler::clear() {
+		memset(left, 0, sizeof(left));
+		memset(right, 0, sizeof(right));
+		count = HALF - 1;
+		position = static_cast<unsigned long long>(HALF - 1) << 32;
+	}
+
+	// Drop the input samples the next output does not use
+	void Resampler::compact() {
+		const int first = static_cast<int>(position >> 32) - (HALF - 1);
+		if(first <= 0) {
+			return;
+		}
+		memmove(left, left + first, (count - first) * sizeof(float));
+		memmove(right, right + first, (count - first) * sizeof(float));
+		count -= first;
+		position -= static_cast<unsigned long long>(first) << 32;
+	}
+
+	/**
+	 * Add count input samples of each side. If the output is not read the
+	 * input is dropped when the buffers are full, then it returns false.
+	 */
+	bool Resampler::write(const float *_left, const float *_right, const int samples) {
+		compact();
+		int n = samples;
+		const bool overflow = count + n > CAPACITY;
+		if(overflow) {
+			clear();
+			if(n > CAPACITY - count) {
+				_left += n - (CAPACITY - count);
+				_right += n - (CAPACITY - count);
+				n = CAPACITY - count;
+			}
+		}
+		memcpy(left + count, _left, n * sizeof(float));
+		memcpy(right + count, _right, n * sizeof(float));
+		count += n;
+		return !overflow;
+	}
+
+	// Output samples that read() can make with the input written so far
+	int Resampler::available() const {
+		const long long last = count - 1 - HALF; // last input sample an output can start at
+		if(last < static_cast<long long>(position >> 32)) {
+			return 0;
+		}
+		return static_cast<int>(((static_cast<unsigned long long>(last) << 32 | 0xFFFFFFFFULL) - position) / step) + 1;
+	}
+
+	/**
+	 * Make up to samples stereo samples, 16 bit left and right interleaved,
+	 * returns how many were made.
+	 */
+	int Resampler::read(short *out, const int samples) {
+		const int n = available() < samples ? available() : samples;
+		float sums[2];
+		for(int i = 0; i < n; i++) {
+			const int first = static_cast<int>(position >> 32) - (HALF - 1);
+			const unsigned int frac = static_cast<unsigned int>(position);
+			const int phase = frac >> PHASE_SHIFT;
+			kernel(left + first, right + first, coefficients[phase], coefficients[phase + 1],
+				(frac & ((1 << PHASE_SHIFT) - 1)) * (1.0f / (1 << PHASE_SHIFT)), sums);
+			out[i * 2] = to_sample(sums[0]);
+			out[i * 2 + 1] = to_sample(sums[1]);
+			position += step;
+		}
+		return n;
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _RESAMPLER_H_
+#define _RESAMPLER_H_
+
+#include "types.h"
+
+// Stereo sample rate conversion with a windowed sinc (Kaiser) polyphase
+// filter, the coefficients are interpolated between the phases so any
+// ratio works. The scalar kernel is the reference, the SSE2/AVX2 ones
+// only change the order of the float sums.
+
+namespace gbpp {
+
+	// Name of the kernel in use: "avx2", "sse2" or "scalar".
+	const char *resampler_kernels();
+
+	class Resampler {
+	public:
+		static const int TAPS = 64;
+		static const int PHASES = 256;
+		static const int CAPACITY = 16384; // input samples kept
+
+		explicit Resampler(const bool scalar = false);
+
+		void set_rates(const double input_rate, const double output_rate);
+		void set_ratio(const double _ratio);
+		double get_ratio() const;
+
+		bool write(const float *left, const float *right, const int count);
+		int available() const;
+		int read(short *out, const int count);
+		void clear();
+
+	private:
+		typedef void (*DotKernel)(const float *, const float *, const float *, const float *,
+			const float, float *);
+
+		DotKernel kernel;
+		double input_rate;
+		double output_rate;
+		double ratio;
+		unsigned long long step;     // input samples per output sample, 32 bit fraction
+		unsigned long long position; // of the next output sample in the input
+		int count;                   // input samples in the buffers
+
+		alignas(32) float coefficients[PHASES + 1][TAPS];
+		alignas(32) float left[CAPACITY + TAPS];
+		alignas(32) float right[CAPACITY + TAPS];
+
+		void build_coefficients();
+		void update_step();
+		void compact();
+
+		Resampler(const Resampler &);
+		Resampler &operator=(const Resampler &);
+	};
+}
+
+#endif /* _RESAMPLER_H_ */
@@ -0,0 +1,144 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _RING_BUFFER_H_
+#define _RING_BUFFER_H_
+
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <cstddef>
+
+namespace gbpp {
+
+	/**
+	 * Bounded single-producer/single-consumer queue, lock free.
+	 * One thread may only push and the other may only pop.
+	 * back()/push() and front()/pop() let both sides work in place,
+	 * without copying the item.
+	 */
+	template<typename T>
+	class RingBuffer {
+	public:
+		RingBuffer(const size_t _capacity) : slots(_capacity + 1), head(0), tail(0) {}
+
+		// Producer: free slot to fill, 0 if the queue is full
+		T *back() {
+			size_t t = tail.load(std::memory_order_relaxed);
+			if(next(t) == head.load(std::memory_order_acquire)) {
+				return 0;
+			}
+			return &slots[t];
+		}
+
+		// Producer: publish the slot returned by back()
+		void push() {
+			tail.store(next(tail.load(std::memory_order_relaxed)), std::memory_order_release);
+		}
+
+		bool push(const T &item) {
+			T *slot = back();
+			if(!slot) {
+				return false;
+			}
+			*slot = item;
+			push();
+			return true;
+		}
+
+		// Producer: copy up to count items, returns how many fit
+		size_t push(const T *items, const size_t count) {
+			const size_t t = tail.load(std::memory_order_relaxed);
+			const size_t free = (head.load(std::memory_order_acquire) + slots.size() - t - 1) % slots.size();
+			const size_t n = count < free ? count : free;
+			// At most two runs, up to the end of the slots and from the start
+			const size_t first = n < slots.size() - t ? n : slots.size() - t;
+			std::copy(items, items + first, slots.begin() + t);
+			std::copy(items + first, items + n, slots.begin());
+			tail.store((t + n) % slots.size(), std::memory_order_release);
+			return n;
+		}
+
+		// Consumer: oldest item, 0 if the queue is empty
+		T *front() {
+			size_t h = head.load(std::memory_order_relaxed);
+			if(h == tail.load(std::memory_order_acquire)) {
+				return 0;
+			}
+			return &slots[h];
+		}
+
+		// Consumer: release the item returned by front()
+		void pop() {
+			head.store(next(head.load(std::memory_order_relaxed)), std::memory_order_release);
+		}
+
+		bool pop(T &item) {
+			T *slot = front();
+			if(!slot) {
+				return false;
+			}
+			item = *slot;
+			pop();
+			return true;
+		}
+
+		// Consumer: copy up to count items, returns how many there were
+		size_t pop(T *items, const size_t count) {
+			const size_t h = head.load(std::memory_order_relaxed);
+			const size_t used = (tail.load(std::memory_order_acquire) + slots.size() - h) % slots.size();
+			const size_t n = count < used ? count : used;
+			const size_t first = n < slots.size() - h ? n : slots.size() - h;
+			std::copy(slots.begin() + h, slots.begin() + h + first, items);
+			std::copy(slots.begin(), slots.begin() + (n - first), items + first);
+			head.store((h + n) % slots.size(), std::memory_order_release);
+			return n;
+		}
+
+		size_t size() const {
+			size_t h = head.load(std::memory_order_acquire);
+			size_t t = tail.load(std::memory_order_acquire);
+			return (t + slots.size() - h) % slots.size();
+		}
+
+		size_t capacity() const {
+			return slots.size() - 1;
+		}
+
+		// Empty it with room for _capacity items, only when no side uses it
+		void resize(const size_t _capacity) {
+			slots.assign(_capacity + 1, T());
+			head.store(0, std::memory_order_relaxed);
+			tail.store(0, std::memory_order_relaxed);
+		}
+
+	private:
+		std::vector<T> slots; // one slot always empty, to tell full from empty
+		alignas(64) std::atomic<size_t> head; // next item to pop
+		alignas(64) std::atomic<size_t> tail; // next slot to push
+
+		size_t next(const size_t i) const {
+			return (i + 1) % slots.size();
+		}
+
+		RingBuffer(const RingBuffer &);
+		RingBuffer &operator=(const RingBuffer &);
+	};
+}
+
+#endif /* _RING_BUFFER_H_ */
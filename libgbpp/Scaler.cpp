@@ -0,0 +1,513 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include <cstring>
+#include <vector>
+#include "Scaler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GBPP_X86
+#include <immintrin.h>
+#endif
+
+namespace gbpp {
+
+	// Scale one line. above, row and below have one extra pixel on each
+	// side (the edge pixel repeated), out has one pointer per output line.
+	typedef void (*RowKernel)(const dword *, const dword *, const dword *, const int,
+		const int, dword *const *);
+
+	struct ScalerKernels {
+		RowKernel rows[4];
+		const char *name;
+	};
+
+	static void copy_lines(dword *const *out, const int lines, const int width) {
+		for(int i = 1; i < lines; i++) {
+			memcpy(out[i], out[0], width * sizeof(dword));
+		}
+	}
+
+	// Round up average of every byte, the same as pavgb
+	static inline dword average(const dword a, const dword b) {
+		return (a | b) - (((a ^ b) >> 1) & 0x7F7F7F7F);
+	}
+
+	static void nearest_line(const dword *row, const int width, const int factor, dword *line) {
+		for(int x = 0; x < width; x++) {
+			for(int i = 0; i < factor; i++) {
+				line[x * factor + i] = row[x];
+			}
+		}
+	}
+
+	static void nearest_row_scalar(const dword *, const dword *row, const dword *,
+			const int width, const int factor, dword *const *out) {
+		nearest_line(row, width, factor, out[0]);
+		copy_lines(out, factor, width * factor);
+	}
+
+	// A B C
+	// D E F  ->  E0 E1
+	// G H I      E2 E3
+	static void scale2x_row_scalar(const dword *above, const dword *row, const dword *below,
+			const int width, const int, dword *const *out) {
+		for(int x = 0; x < width; x++) {
+			const dword B = above[x], D = row[x - 1], E = row[x], F = row[x + 1], H = below[x];
+			out[0][x * 2]     = D == B && B != F && D != H ? D : E;
+			out[0][x * 2 + 1] = B == F && B != D && F != H ? F : E;
+			out[1][x * 2]     = D == H && D != B && H != F ? D : E;
+			out[1][x * 2 + 1] = H == F && D != H && B != F ? F : E;
+		}
+	}
+
+	static void blend2x_row_scalar(const dword *above, const dword *row, const dword *below,
+			const int width, const int, dword *const *out) {
+		for(int x = 0; x < width; x++) {
+			const dword B = above[x], D = row[x - 1], E = row[x], F = row[x + 1], H = below[x];
+			out[0][x * 2]     = average(E, D == B && B != F && D != H ? D : E);
+			out[0][x * 2 + 1] = average(E, B == F && B != D && F != H ? F : E);
+			out[1][x * 2]     = average(E, D == H && D != B && H != F ? D : E);
+			out[1][x * 2 + 1] = average(E, H == F && D != H && B != F ? F : E);
+		}
+	}
+
+	static void scale3x_row_scalar(const dword *above, const dword *row, const dword *below,
+			const int width, const int, dword *const *out) {
+		for(int x = 0; x < width; x++) {
+			const dword A = above[x - 1], B = above[x], C = above[x + 1];
+			const dword D = row[x - 1], E = row[x], F = row[x + 1];
+			const dword G = below[x - 1], H = below[x], I = below[x + 1];
+			const bool db = D == B && B != F && D != H;
+			const bool bf = B == F && B != D && F != H;
+			const bool dh = D == H && D != B && H != F;
+			const bool hf = H == F && D != H && B != F;
+			dword *line0 = out[0] + x * 3, *line1 = out[1] + x * 3, *line2 = out[2] + x * 3;
+			line0[0] = db ? D : E;
+			line0[1] = (db && E != C) || (bf && E != A) ? B : E;
+			line0[2] = bf ? F : E;
+			line1[0] = (db && E != G) || (dh && E != A) ? D : E;
+			line1[1] = E;
+			line1[2] = (bf && E != I) || (hf && E != C) ? F : E;
+			line2[0] = dh ? D : E;
+			line2[1] = (dh && E != I) || (hf && E != G) ? H : E;
+			line2[2] = hf ? F : E;
+		}
+	}
+
+	// Finish a line with the scalar kernel, from pixel x on
+	static inline void finish_row(const RowKernel kernel, const dword *above, const dword *row,
+			const dword *below, const int x, const int width, const int factor, const int scale,
+			dword *const *out) {
+		dword *tail[4];
+		for(int i = 0; i < scale; i++) {
+			tail[i] = out[i] + x * scale;
+		}
+		kernel(above + x, row + x, below + x, width - x, factor, tail);
+	}
+
+#ifdef GBPP_X86
+	__attribute__((target("sse2")))
+	static inline __m128i select_sse2(const __m128i mask, const __m128i a, const __m128i b) {
+		return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+	}
+
+	// Store a0 b0 c0 a1 b1 c1 a2 b2 c2 a3 b3 c3
+	__attribute__((target("sse2")))
+	static inline void store3_sse2(const __m128i a, const __m128i b, const __m128i c, dword *out) {
+		__m128 ab_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(a, b));
+		__m128 ab_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(a, b));
+		__m128 bc_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(b, c));
+		__m128 bc_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(b, c));
+		__m128 ca_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(c, a));
+		__m128 ca_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(c, a));
+		_mm_storeu_ps(reinterpret_cast<float *>(out), _mm_shuffle_ps(ab_lo, ca_lo, _MM_SHUFFLE(3, 0, 1, 0)));
+		_mm_storeu_ps(reinterpret_cast<float *>(out + 4), _mm_shuffle_ps(bc_lo, ab_hi, _MM_SHUFFLE(1, 0, 3, 2)));
+		_mm_storeu_ps(reinterpret_cast<float *>(out + 8), _mm_shuffle_ps(ca_hi, bc_hi, _MM_SHUFFLE(3, 2, 3, 0)));
+	}
+
+	__attribute__((target("sse2")))
+	static inline void store2_sse2(const __m128i a, const __m128i b, dword *out) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi32(a, b));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4), _mm_unpackhi_epi32(a, b));
+	}
+
+	__attribute__((target("sse2")))
+	static inline __m128i load_sse2(const dword *pixels) {
+		return _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+	}
+
+	__attribute__((target("sse2")))
+	static void nearest_row_sse2(const dword *, const dword *row, const dword *,
+			const int width, const int factor, dword *const *out) {
+		int x = 0;
+		for(; x + 4 <= width; x += 4) {
+			__m128i E = load_sse2(row + x);
+			dword *line = out[0] + x * factor;
+			if(factor == 2) {
+				store2_sse2(E, E, line);
+			} else if(factor == 3) {
+				store3_sse2(E, E, E, line);
+			} else if(factor == 4) {
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(line), _mm_shuffle_epi32(E, 0x00));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(line + 4), _mm_shuffle_epi32(E, 0x55));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(line + 8), _mm_shuffle_epi32(E, 0xAA));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(line + 12), _mm_shuffle_epi32(E, 0xFF));
+			} else {
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(line), E);
+			}
+		}
+		nearest_line(row + x, width - x, factor, out[0] + x * factor);
+		copy_lines(out, factor, width * factor);
+	}
+
+	// Scale2x edge masks of 4 pixels
+	__attribute__((target("sse2")))
+	static inline void scale2x_masks_sse2(const dword *above, const dword *row, const dword *below,
+			__m128i *D, __m128i *E, __m128i *F, __m128i *masks) {
+		__m128i B = load_sse2(above);
+		__m128i H = load_sse2(below);
+		*D = load_sse2(row - 1);
+		*E = load_sse2(row);
+		*F = load_sse2(row + 1);
+		__m128i BD = _mm_cmpeq_epi32(B, *D);
+		__m128i BF = _mm_cmpeq_epi32(B, *F);
+		__m128i DH = _mm_cmpeq_epi32(*D, H);
+		__m128i HF = _mm_cmpeq_epi32(H, *F);
+		masks[0] = _mm_andnot_si128(_mm_or_si128(BF, DH), BD);
+		masks[1] = _mm_andnot_si128(_mm_or_si128(BD, HF), BF);
+		masks[2] = _mm_andnot_si128(_mm_or_si128(BD, HF), DH);
+		masks[3] = _mm_andnot_si128(_mm_or_si128(DH, BF), HF);
+	}
+
+	__attribute__((target("sse2")))
+	static void scale2x_row_sse2(const dword *above, const dword *row, const dword *below,
+			const int width, const int factor, dword *const *out) {
+		int x = 0;
+		for(; x + 4 <= width; x += 4) {
+			__m128i D, E, F, masks[4];
+			scale2x_masks_sse2(above + x, row + x, below + x, &D, &E, &F, masks);
+			store2_sse2(select_sse2(masks[0], D, E), select_sse2(masks[1], F, E), out[0] + x * 2);
+			store2_sse2(select_sse2(masks[2], D, E), select_sse2(masks[3], F, E), out[1] + x * 2);
+		}
+		finish_row(scale2x_row_scalar, above, row, below, x, width, factor, 2, out);
+	}
+
+	__attribute__((target("sse2")))
+	static void blend2x_row_sse2(const dword *above, const dword *row, const dword *below,
+			const int width, const int factor, dword *const *out) {
+		int x = 0;
+		for(; x + 4 <= width; x += 4) {
+			__m128i D, E, F, masks[4];
+			scale2x_masks_sse2(above + x, row + x, below + x, &D, &E, &F, masks);
+			store2_sse2(_mm_avg_epu8(E, select_sse2(masks[0], D, E)),
+				_mm_avg_epu8(E, select_sse2(masks[1], F, E)), out[0] + x * 2);
+			store2_sse2(_mm_avg_epu8(E, select_sse2(masks[2], D, E)),
+				_mm_avg_epu8(E, select_sse2(masks[3], F, E)), out[1] + x * 2);
+		}
+		finish_row(blend2x_row_scalar, above, row, below, x, width, factor, 2, out);
+	}
+
+	__attribute__((target("sse2")))
+	static void scale3x_row_sse2(const dword *above, const dword *row, const dword *below,
+			const int width, const int factor, dword *const *out) {
+		int x = 0;
+		for(; x + 4 <= width; x += 4) {
+			__m128i D, E, F, masks[4];
+			scale2x_masks_sse2(above + x, row + x, below + x, &D, &E, &F, masks);
+			__m128i B = load_sse2(above + x);
+			__m128i H = load_sse2(below + x);
+			__m128i not_A = _mm_cmpeq_epi32(E, load_sse2(above + x - 1));
+			__m128i not_C = _mm_cmpeq_epi32(E, load_sse2(above + x + 1));
+			__m128i not_G = _mm_cmpeq_epi32(E, load_sse2(below + x - 1));
+			__m128i not_I = _mm_cmpeq_epi32(E, load_sse2(below + x + 1));
+			const __m128i &db = masks[0], &bf = masks[1], &dh = masks[2], &hf = masks[3];
+			store3_sse2(select_sse2(db, D, E),
+				select_sse2(_mm_or_si128(_mm_andnot_si128(not_C, db), _mm_andnot_si128(not_A, bf)), B, E),
+				select_sse2(bf, F, E), out[0] + x * 3);
+			store3_sse2(select_sse2(_mm_or_si128(_mm_andnot_si128(not_G, db), _mm_andnot_si128(not_A, dh)), D, E),
+				E,
+				select_sse2(_mm_or_si128(_mm_andnot_si128(not_I, bf), _mm_andnot_si128(not_C, hf)), F, E),
+				out[1] + x * 3);
+			store3_sse2(select_sse2(dh, D, E),
+				select_sse2(_mm_or_si128(_mm_andnot_si128(not_I, dh), _mm_andnot_si128(not_G, hf)), H, E),
+				select_sse2(hf, F, E), out[2] + x * 3);
+		}
+		finish_row(scale3x_row_scalar, above, row, below, x, width, factor, 3, out);
+	}
+
+	__attribute__((target("avx2")))
+	static inline __m256i select_avx2(const __m256i mask, const __m256i a, const __m256i b) {
+		return _mm256_blendv_epi8(b, a, mask);
+	}
+
+	__attribute__((target("avx2")))
+	static inline __m256i load_avx2(const dword *pixels) {
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels));
+	}
+
+	// Store a0 b0 a1 b1 ... a7 b7, unpack works inside each 128 bit lane
+	__attribute__((target("avx2")))
+	static inline void store2_avx2(const __m256i a, const __m256i b, dword *out) {
+		__m256i lo = _mm256_unpacklo_epi32(a, b);
+		__m256i hi = _mm256_unpackhi_epi32(a, b);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	__attribute__((target("avx2")))
+	static void nearest_row_avx2(const dword *above, const dword *row, const dword *below,
+			const int width, const int factor, dword *const *out) {
+		if(factor != 2 && factor != 4) {
+			nearest_row_sse2(above, row, below, width, factor, out);
+			return;
+		}
+		int x = 0;
+		for(; x + 8 <= width; x += 8) {
+			__m256i E = load_avx2(row + x);
+			dword *line = out[0] + x * factor;
+			if(factor == 2) {
+				store2_avx2(E, E, line);
+			} else {
+				for(int i = 0; i < 4; i++) {
+					__m256i index = _mm256_set_epi32(i * 2 + 1, i * 2 + 1, i * 2 + 1, i * 2 + 1,
+						i * 2, i * 2, i * 2, i * 2);
+					_mm256_storeu_si256(reinterpret_cast<__m256i *>(line + i * 8),
+						_mm256_permutevar8x32_epi32(E, index));
+				}
+			}
+		}
+		nearest_line(row + x, width - x, factor, out[0] + x * factor);
+		copy_lines(out, factor, width * factor);
+	}
+
+	__attribute__((target("avx2")))
+	static inline void scale2x_masks_avx2(const dword *above, const dword *row, const dword *below,
+			__m256i *D, __m256i *E, __m256i *F, __m256i *masks) {
+		__m256i B = load_avx2(above);
+		__m256i H = load_avx2(below);
+		*D = load_avx2(row - 1);
+		*E = load_avx2(row);
+		*F = load_avx2(row + 1);
+		__m256i BD = _mm256_cmpeq_epi32(B, *D);
+		__m256i BF = _mm256_cmpeq_epi32(B, *F);
+		__m256i DH = _mm256_cmpeq_epi32(*D, H);
+		__m256i HF = _mm256_cmpeq_epi32(H, *F);
+		masks[0] = _mm256_andnot_si256(_mm256_or_si256(BF, DH), BD);
+		masks[1] = _mm256_andnot_si256(_mm256_or_si256(BD, HF), BF);
+		masks[2] = _mm256_andnot_si256(_mm256_or_si256(BD, HF), DH);
+		masks[3] = _mm256_andnot_si256(_mm256_or_si256(DH, BF), HF);
+	}
+
+	__attribute__((target("avx2")))
+	static void scale2x_row_avx2(const dword *above, const dword *row, const dword *below,
+			const int width, const int factor, dword *const *out) {
+		int x = 0;
+		for(; x + 8 <= width; x += 8) {
+			__m256i D, E, F, masks[4];
+			scale2x_masks_avx2(above + x, row + x, below + x, &D, &E, &F, masks);
+			store2_avx2(select_avx2(masks[0], D, E), select_avx2(masks[1], F, E), out[0] + x * 2);
+			store2_avx2(select_avx2(masks[2], D, E), select_avx2(masks[3], F, E), out[1] + x * 2);
+		}
+		finish_row(scale2x_row_scalar, above, row, below, x, width, factor, 2, out);
+	}
+
+	__attribute__((target("avx2")))
+	static void blend2x_row_avx2(const dword *above, const dword *row, const dword *below,
+			const int width, const int factor, dword *const *out) {
+		int x = 0;
+		for(; x + 8 <= width; x += 8) {
+			__m256i D, E, F, masks[4];
+			scale2x_masks_avx2(above + x, row + x, below + x, &D, &E, &F, masks);
+			store2_avx2(_mm256_avg_epu8(E, select_avx2(masks[0], D, E)),
+				_mm256_avg_epu8(E, select_avx2(masks[1], F, E)), out[0] + x * 2);
+			store2_avx2(_mm256_avg_epu8(E, select_avx2(masks[2], D, E)),
+				_mm256_avg_epu8(E, select_avx2(masks[3], F, E)), out[1] + x * 2);
+		}
+		finish_row(blend2x_row_scalar, above, row, below, x, width, factor, 2, out);
+	}
+#endif
+
+	static ScalerKernels select_scaler_kernels() {
+		ScalerKernels kernels = {
+			{ nearest_row_scalar, scale2x_row_scalar, scale3x_row_scalar, blend2x_row_scalar },
+			"scalar"
+		};
+#ifdef GBPP_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			// Scale3x writes three pixels per source pixel, it stays on SSE2
+			ScalerKernels avx2 = {
+				{ nearest_row_avx2, scale2x_row_avx2, scale3x_row_sse2, blend2x_row_avx2 },
+				"avx2"
+			};
+			kernels = avx2;
+		} else if(__builtin_cpu_supports("sse2")) {
+			ScalerKernels sse2 = {
+				{ nearest_row_sse2, scale2x_row_sse2, scale3x_row_sse2, blend2x_row_sse2 },
+				"sse2"
+			};
+			kernels = sse2;
+		}
+#endif
+		return kernels;
+	}
+
+	// Selected once, the Scaler worker may be the first caller
+	static const ScalerKernels &scaler_kernel_table() {
+		static const ScalerKernels kernels = select_scaler_kernels();
+		return kernels;
+	}
+
+	static const ScalerKernels &scalar_kernel_table() {
+		static const ScalerKernels kernels = {
+			{ nearest_row_scalar, scale2x_row_scalar, scale3x_row_scalar, blend2x_row_scalar },
+			"scalar"
+		};
+		return kernels;
+	}
+
+	static void load_row(const byte *src, const int width, dword *row) {
+		memcpy(row, src, width * sizeof(dword));
+		row[-1] = row[0];
+		row[width] = row[width - 1];
+	}
+
+	static void scale_rows(const ScalerKernels &kernels, const int filter, const int factor,
+			const byte *src, const int src_pitch, const int width, const int height,
+			byte *dst, const int dst_pitch) {
+		const int scale = scale_factor(filter, factor);
+		if(width <= 0 || height <= 0 || filter < FILTER_NEAREST || filter > FILTER_BLEND2X) {
+			return;
+		}
+		if(scale == 1) {
+			for(int y = 0; y < height; y++) {
+				memcpy(dst + y * dst_pitch, src + y * src_pitch, width * sizeof(dword));
+			}
+			return;
+		}
+
+		// Three padded lines, rotated as the filter moves down
+		const int padded = width + 2;
+		std::vector<dword> lines(padded * 3);
+		dword *above = &lines[1], *row = &lines[padded + 1], *below = &lines[padded * 2 + 1];
+		load_row(src, width, row);
+		memcpy(above - 1, row - 1, padded * sizeof(dword));
+
+		dword *out[4];
+		for(int y = 0; y < height; y++) {
+			if(y + 1 < height) {
+				load_row(src + (y + 1) * src_pitch, width, below);
+			} else {
+				memcpy(below - 1, row - 1, padded * sizeof(dword));
+			}
+			for(int i = 0; i < scale; i++) {
+				out[i] = reinterpret_cast<dword *>(dst + (y * scale + i) * dst_pitch);
+			}
+			kernels.rows[filter](above, row, below, width, scale, out);
+
+			dword *free_line = above;
+			above = row;
+			row = below;
+			below = free_line;
+		}
+	}
+
+	void scale_frame(const int filter, const int factor, const byte *src, const int src_pitch,
+			const int width, const int height, byte *dst, const int dst_pitch) {
+		scale_rows(scaler_kernel_table(), filter, factor, src, src_pitch, width, height, dst, dst_pitch);
+	}
+
+	void scale_frame_scalar(const int filter, const int factor, const byte *src, const int src_pitch,
+			const int width, const int height, byte *dst, const int dst_pitch) {
+		scale_rows(scalar_kernel_table(), filter, factor, src, src_pitch, width, height, dst, dst_pitch);
+	}
+
+	int scale_factor(const int filter, const int factor) {
+		switch(filter) {
+			case FILTER_NEAREST:
+				return factor < 1 ? 1 : (factor > 4 ? 4 : factor);
+			case FILTER_SCALE3X:
+				return 3;
+			default:
+				return 2;
+		}
+	}
+
+	const char *scaler_kernels() {
+		return scaler_kernel_table().name;
+	}
+
+	Scaler::Scaler(const int _filter, const int _factor) : filter(_filter), factor(_factor),
+			src(0), src_pitch(0), width(0), height(0), dst(0), dst_pitch(0),
+			pending(false), quit(false), worker(&Scaler::work, this) {
+	}
+
+	Scaler::~Scaler() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit = true;
+		}
+		job_changed.notify_all();
+		worker.join();
+	}
+
+	int Scaler::get_factor() const {
+		return scale_factor(filter, factor);
+	}
+
+	void Scaler::submit(const byte *_src, const int _src_pitch, const int _width, const int _height,
+			byte *_dst, const int _dst_pitch) {
+		wait();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			src = _src;
+			src_pitch = _src_pitch;
+			width = _width;
+			height = _height;
+			dst = _dst;
+			dst_pitch = _dst_pitch;
+			pending = true;
+		}
+		job_changed.notify_all();
+	}
+
+	void Scaler::wait() {
+		std::unique_lock<std::mutex> guard(lock);
+		while(pending) {
+			job_changed.wait(guard);
+		}
+	}
+
+	void Scaler::work() {
+		std::unique_lock<std::mutex> guard(lock);
+		while(true) {
+			while(!pending && !quit) {
+				job_changed.wait(guard);
+			}
+			if(!pending) {
+				return;
+			}
+			guard.unlock();
+			scale_frame(filter, factor, src, src_pitch, width, height, dst, dst_pitch);
+			guard.lock();
+			pending = false;
+			job_changed.notify_all();
+		}
+	}
+}
@@ -0,0 +1,92 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _SCALER_H_
+#define _SCALER_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "types.h"
+
+// CPU side upscaling of 32 bit frames (FORMAT_RGBA32 or FORMAT_BGRA32),
+// for outputs that can not let the GPU do it. Every filter has a scalar
+// reference, the SSE2/AVX2 kernels give exactly the same pixels.
+
+namespace gbpp {
+
+	enum {
+		FILTER_NEAREST, // integer factor 1-4
+		FILTER_SCALE2X,
+		FILTER_SCALE3X,
+		FILTER_BLEND2X  // Scale2x edges blended with the center pixel
+	};
+
+	// Scale width x height pixels of src into dst, pitches in bytes.
+	// dst must hold width * scale_factor() x height * scale_factor() pixels.
+	void scale_frame(const int filter, const int factor, const byte *src, const int src_pitch,
+		const int width, const int height, byte *dst, const int dst_pitch);
+	void scale_frame_scalar(const int filter, const int factor, const byte *src, const int src_pitch,
+		const int width, const int height, byte *dst, const int dst_pitch);
+
+	// Output size of a filter, factor is only used by FILTER_NEAREST.
+	int scale_factor(const int filter, const int factor);
+
+	// Name of the kernels in use: "avx2", "sse2" or "scalar".
+	const char *scaler_kernels();
+
+	/**
+	 * Runs a filter on its own worker thread: submit() a frame, do
+	 * something else, then wait() before touching src or dst again.
+	 */
+	class Scaler {
+	public:
+		Scaler(const int _filter, const int _factor);
+		~Scaler();
+
+		int get_factor() const;
+		void submit(const byte *src, const int src_pitch, const int width, const int height,
+			byte *dst, const int dst_pitch);
+		void wait();
+
+	private:
+		int filter;
+		int factor;
+
+		// Current job
+		const byte *src;
+		int src_pitch;
+		int width;
+		int height;
+		byte *dst;
+		int dst_pitch;
+
+		bool pending;
+		bool quit;
+		std::mutex lock;
+		std::condition_variable job_changed;
+		std::thread worker;
+
+		void work();
+
+		Scaler(const Scaler &);
+		Scaler &operator=(const Scaler &);
+	};
+}
+
+#endif /* _SCALER_H_ */
@@ -0,0 +1,202 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include "Simd.h"
+#include "util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GBPP_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GBPP_NEON
+#include <arm_neon.h>
+#endif
+
+namespace gbpp {
+
+	void expand_2bpp_scalar(const byte *data, const int rows, byte *out) {
+		for(int row = 0; row < rows; row++) {
+			byte data1 = data[row * 2];
+			byte data2 = data[row * 2 + 1];
+			for(int color_bit = 7; color_bit >= 0; color_bit--) {
+				*out++ = (get_bit(data2, color_bit) << 1) | get_bit(data1, color_bit);
+			}
+		}
+	}
+
+	void map_colors_scalar(const byte *in, const byte *table, const int count, byte *out) {
+		for(int i = 0; i < count; i++) {
+			out[i] = table[in[i]];
+		}
+	}
+
+#ifdef GBPP_X86
+	// Turn every byte of lo/hi (one bitplane byte replicated 8 times) into
+	// color numbers, using the bit selected by the lane position.
+	__attribute__((target("sse2")))
+	static inline __m128i combine_planes_sse2(const __m128i lo, const __m128i hi) {
+		const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+		__m128i color = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), _mm_set1_epi8(1));
+		return _mm_or_si128(color,
+			_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), _mm_set1_epi8(2)));
+	}
+
+	__attribute__((target("sse2")))
+	static void expand_2bpp_sse2(const byte *data, const int rows, byte *out) {
+		int row = 0;
+		for(; row + 8 <= rows; row += 8) {
+			__m128i tile = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + row * 2));
+			// l0..l7 h0..h7
+			__m128i planes = _mm_packus_epi16(_mm_and_si128(tile, _mm_set1_epi16(0xFF)),
+				_mm_srli_epi16(tile, 8));
+			__m128i lo = _mm_unpacklo_epi8(planes, planes);
+			__m128i hi = _mm_unpackhi_epi8(planes, planes);
+			__m128i lo_a = _mm_unpacklo_epi16(lo, lo);
+			__m128i lo_b = _mm_unpackhi_epi16(lo, lo);
+			__m128i hi_a = _mm_unpacklo_epi16(hi, hi);
+			__m128i hi_b = _mm_unpackhi_epi16(hi, hi);
+
+			__m128i *dst = reinterpret_cast<__m128i *>(out + row * 8);
+			_mm_storeu_si128(dst,     combine_planes_sse2(_mm_unpacklo_epi32(lo_a, lo_a), _mm_unpacklo_epi32(hi_a, hi_a)));
+			_mm_storeu_si128(dst + 1, combine_planes_sse2(_mm_unpackhi_epi32(lo_a, lo_a), _mm_unpackhi_epi32(hi_a, hi_a)));
+			_mm_storeu_si128(dst + 2, combine_planes_sse2(_mm_unpacklo_epi32(lo_b, lo_b), _mm_unpacklo_epi32(hi_b, hi_b)));
+			_mm_storeu_si128(dst + 3, combine_planes_sse2(_mm_unpackhi_epi32(lo_b, lo_b), _mm_unpackhi_epi32(hi_b, hi_b)));
+		}
+		expand_2bpp_scalar(data + row * 2, rows - row, out + row * 8);
+	}
+
+	__attribute__((target("ssse3")))
+	static void map_colors_ssse3(const byte *in, const byte *table, const int count, byte *out) {
+		const __m128i lookup = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table));
+		int i = 0;
+		for(; i + 16 <= count; i += 16) {
+			__m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_shuffle_epi8(lookup, values));
+		}
+		map_colors_scalar(in + i, table, count - i, out + i);
+	}
+
+	__attribute__((target("avx2")))
+	static inline __m256i combine_planes_avx2(const __m256i tile, const __m256i lo_index) {
+		const __m256i bits = _mm256_broadcastsi128_si256(
+			_mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+		__m256i lo = _mm256_shuffle_epi8(tile, lo_index);
+		__m256i hi = _mm256_shuffle_epi8(tile, _mm256_add_epi8(lo_index, _mm256_set1_epi8(1)));
+		__m256i color = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), _mm256_set1_epi8(1));
+		return _mm256_or_si256(color,
+			_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), _mm256_set1_epi8(2)));
+	}
+
+	// One tile per iteration: the 16 data bytes are broadcast to both lanes
+	// and each bitplane byte is replicated 8 times with a shuffle.
+	__attribute__((target("avx2")))
+	static void expand_2bpp_avx2(const byte *data, const int rows, byte *out) {
+		const __m256i rows_0_3 = _mm256_setr_epi8(
+			0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2,
+			4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6);
+		const __m256i rows_4_7 = _mm256_add_epi8(rows_0_3, _mm256_set1_epi8(8));
+		int row = 0;
+		for(; row + 8 <= rows; row += 8) {
+			__m256i tile = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + row * 2)));
+			__m256i *dst = reinterpret_cast<__m256i *>(out + row * 8);
+			_mm256_storeu_si256(dst,     combine_planes_avx2(tile, rows_0_3));
+			_mm256_storeu_si256(dst + 1, combine_planes_avx2(tile, rows_4_7));
+		}
+		expand_2bpp_scalar(data + row * 2, rows - row, out + row * 8);
+	}
+
+	__attribute__((target("avx2")))
+	static void map_colors_avx2(const byte *in, const byte *table, const int count, byte *out) {
+		const __m256i lookup = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(table)));
+		int i = 0;
+		for(; i + 32 <= count; i += 32) {
+			__m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_shuffle_epi8(lookup, values));
+		}
+		map_colors_scalar(in + i, table, count - i, out + i);
+	}
+#endif
+
+#ifdef GBPP_NEON
+	static void expand_2bpp_neon(const byte *data, const int rows, byte *out) {
+		static const byte bits[8] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+		const uint8x8_t mask = vld1_u8(bits);
+		for(int row = 0; row < rows; row++) {
+			uint8x8_t lo = vand_u8(vtst_u8(vdup_n_u8(data[row * 2]), mask), vdup_n_u8(1));
+			uint8x8_t hi = vand_u8(vtst_u8(vdup_n_u8(data[row * 2 + 1]), mask), vdup_n_u8(2));
+			vst1_u8(out + row * 8, vorr_u8(lo, hi));
+		}
+	}
+
+	static void map_colors_neon(const byte *in, const byte *table, const int count, byte *out) {
+		uint8x8x2_t lookup;
+		lookup.val[0] = vld1_u8(table);
+		lookup.val[1] = vld1_u8(table + 8);
+		int i = 0;
+		for(; i + 8 <= count; i += 8) {
+			vst1_u8(out + i, vtbl2_u8(lookup, vld1_u8(in + i)));
+		}
+		map_colors_scalar(in + i, table, count - i, out + i);
+	}
+#endif
+
+	std::vector<SimdKernels> supported_simd_kernels() {
+		std::vector<SimdKernels> kernels;
+#if defined(GBPP_X86)
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			SimdKernels avx2 = { expand_2bpp_avx2, map_colors_avx2, "avx2" };
+			kernels.push_back(avx2);
+		}
+		if(__builtin_cpu_supports("ssse3")) {
+			SimdKernels ssse3 = { expand_2bpp_sse2, map_colors_ssse3, "ssse3" };
+			kernels.push_back(ssse3);
+		}
+		if(__builtin_cpu_supports("sse2")) {
+			SimdKernels sse2 = { expand_2bpp_sse2, map_colors_scalar, "sse2" };
+			kernels.push_back(sse2);
+		}
+#elif defined(GBPP_NEON)
+		SimdKernels neon = { expand_2bpp_neon, map_colors_neon, "neon" };
+		kernels.push_back(neon);
+#endif
+		SimdKernels scalar = { expand_2bpp_scalar, map_colors_scalar, "scalar" };
+		kernels.push_back(scalar);
+		return kernels;
+	}
+
+	// Selected once, the first call may come from any thread
+	static const SimdKernels &simd_kernel_table() {
+		static const SimdKernels kernels = supported_simd_kernels().front();
+		return kernels;
+	}
+
+	void expand_2bpp(const byte *data, const int rows, byte *out) {
+		simd_kernel_table().expand(data, rows, out);
+	}
+
+	void map_colors(const byte *in, const byte *table, const int count, byte *out) {
+		simd_kernel_table().colors(in, table, count, out);
+	}
+
+	const char *simd_kernels() {
+		return simd_kernel_table().name;
+	}
+}
@@ -0,0 +1,58 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <vector>
+#include "types.h"
+
+// Pixel kernels used by the Lcd. Every kernel has a scalar reference
+// version, the fastest one supported by the running cpu is selected
+// the first time it is called (AVX2, SSSE3, SSE2 or NEON).
+
+namespace gbpp {
+
+	// Expand rows of 2bpp tile data (two bytes per row, as stored in VRAM)
+	// into color numbers 0-3, 8 per row, leftmost pixel first.
+	void expand_2bpp(const byte *data, const int rows, byte *out);
+	void expand_2bpp_scalar(const byte *data, const int rows, byte *out);
+
+	// Map count values (0-15) through a 16 entry table, one byte shuffle
+	// per 16 or 32 values. Used to resolve pixels through the palettes.
+	void map_colors(const byte *in, const byte *table, const int count, byte *out);
+	void map_colors_scalar(const byte *in, const byte *table, const int count, byte *out);
+
+	// Name of the kernels in use: "avx2", "ssse3", "sse2", "neon" or "scalar".
+	const char *simd_kernels();
+
+	typedef void (*ExpandKernel)(const byte *, const int, byte *);
+	typedef void (*ColorsKernel)(const byte *, const byte *, const int, byte *);
+
+	struct SimdKernels {
+		ExpandKernel expand;
+		ColorsKernel colors;
+		const char *name;
+	};
+
+	// Every kernel set the running cpu supports, fastest first, the scalar
+	// reference last. The first one is in use, the checks run them all.
+	std::vector<SimdKernels> supported_simd_kernels();
+}
+
+#endif /* _SIMD_H_ */
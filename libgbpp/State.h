@@ -0,0 +1,157 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _STATE_H_
+#define _STATE_H_
+
+#include <cstring>
+#include <cstddef>
+#include "types.h"
+
+namespace gbpp {
+
+	/**
+	 * Save states: every component writes its fields in a fixed order,
+	 * as raw bytes in the host layout, and reads them back in the same
+	 * order. A state only loads on the build and host that saved it.
+	 * Without a buffer the writer only counts the size.
+	 */
+	class StateWriter {
+	public:
+		StateWriter(byte *_buffer) : buffer(_buffer), size(0) {}
+
+		template<typename T>
+		void put(const T &value) {
+			put_bytes(&value, sizeof(T));
+		}
+
+		void put(const bool value) {
+			const byte flag = value ? 1 : 0;
+			put_bytes(&flag, 1);
+		}
+
+		void put_bytes(const void *data, const size_t count) {
+			if(buffer) {
+				memcpy(buffer + size, data, count);
+			}
+			size += count;
+		}
+
+		size_t get_size() const {
+			return size;
+		}
+
+	private:
+		byte *buffer;
+		size_t size;
+	};
+
+	/**
+	 * A state is read twice: first only checked (nothing is stored, every
+	 * index and enum must be in its range), then applied. A component
+	 * loads with the same code in both passes, what it does besides
+	 * reading its fields waits for is_applying().
+	 */
+	class StateReader {
+	public:
+		StateReader(const byte *_buffer, const size_t _size, const bool _applying) :
+			buffer(_buffer), size(_size), position(0), applying(_applying), valid(true) {}
+
+		// Any value
+		template<typename T>
+		void get(T &value) {
+			const byte *data = next(sizeof(T));
+			if(data && applying) {
+				memcpy(&value, data, sizeof(T));
+			}
+		}
+
+		void get(bool &value) {
+			const byte flag = read<byte>(0, 1);
+			if(applying) {
+				value = flag != 0;
+			}
+		}
+
+		// A value from min to max
+		template<typename T, typename L>
+		void get(T &value, const L min, const L max) {
+			const T data = read<T>(min, max);
+			if(applying) {
+				value = data;
+			}
+		}
+
+		// A value from min to max that is not stored, min if it is not one
+		template<typename T, typename L>
+		T read(const L min, const L max) {
+			T value = static_cast<T>(min);
+			const byte *data = next(sizeof(T));
+			if(data) {
+				memcpy(&value, data, sizeof(T));
+			}
+			if(value < min || value > max) {
+				valid = false;
+				return static_cast<T>(min);
+			}
+			return value;
+		}
+
+		void get_bytes(void *value, const size_t count) {
+			const byte *data = next(count);
+			if(data && applying) {
+				memcpy(value, data, count);
+			}
+		}
+
+		// Fields that must agree with each other
+		void check(const bool ok) {
+			if(!ok) {
+				valid = false;
+			}
+		}
+
+		bool is_applying() const {
+			return applying;
+		}
+
+		// Every field was in range and the whole buffer was read
+		bool is_valid() const {
+			return valid && position == size;
+		}
+
+	private:
+		const byte *buffer;
+		size_t size;
+		size_t position;
+		bool applying;
+		bool valid;
+
+		const byte *next(const size_t count) {
+			if(count > size - position) {
+				valid = false;
+				position = size;
+				return 0;
+			}
+			position += count;
+			return buffer + position - count;
+		}
+	};
+}
+
+#endif /* _STATE_H_ */
@@ -0,0 +1,159 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include <chrono>
+#include <vector>
+#include "StreamWriter.h"
+
+namespace gbpp {
+
+	StreamWriter::StreamWriter(const size_t buffer) : file(0), seekable(false), error(false),
+			stalls(0), queue(buffer), quit(false) {
+	}
+
+	StreamWriter::~StreamWriter() {
+		close();
+	}
+
+	bool StreamWriter::open(const string _path) {
+		close();
+		path = _path;
+		if(path == "-") {
+			file = stdout;
+		} else {
+			file = fopen(path.c_str(), "wb");
+			if(!file) {
+				return false;
+			}
+		}
+		// Pipes and the standard output can not go back to patch a header
+		seekable = file != stdout && ftell(file) != -1;
+		error = false;
+		stalls = 0;
+		quit = false;
+		worker = std::thread(&StreamWriter::work, this);
+		return true;
+	}
+
+	// Size of the queue in bytes, the file is closed first
+	void StreamWriter::set_buffer(const size_t buffer) {
+		close();
+		if(buffer != queue.capacity()) {
+			queue.resize(buffer);
+		}
+	}
+
+	bool StreamWriter::is_open() const {
+		return file != 0;
+	}
+
+	// Producer side, a single thread. Nothing to do when closed, no
+	// worker would make room in the queue.
+	void StreamWriter::write(const void *data, const size_t size) {
+		if(!is_open()) {
+			return;
+		}
+		const byte *bytes = static_cast<const byte *>(data);
+		size_t written = queue.push(bytes, size);
+		while(written < size) {
+			// The worker is behind, wait for room instead of dropping
+			stalls++;
+			queued.notify_one();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			written += queue.push(bytes + written, size - written);
+		}
+		if(queue.size() >= static_cast<size_t>(BLOCK)) {
+			queued.notify_one();
+		}
+	}
+
+	/**
+	 * Write everything that is queued and close the file. With a
+	 * regular file rewrite() still works until the next open().
+	 */
+	void StreamWriter::close() {
+		if(!file) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit = true;
+		}
+		queued.notify_one();
+		worker.join();
+		if(file == stdout) {
+			fflush(file);
+		} else if(fclose(file) != 0) {
+			error = true;
+		}
+		file = 0;
+	}
+
+	/**
+	 * After close(): replace size bytes at offset of the file, for headers
+	 * that hold the length of the data. False on streams.
+	 */
+	bool StreamWriter::rewrite(const long offset, const void *data, const size_t size) {
+		if(!seekable || file) {
+			return false;
+		}
+		FILE *patch = fopen(path.c_str(), "r+b");
+		if(!patch) {
+			return false;
+		}
+		const bool done = fseek(patch, offset, SEEK_SET) == 0 && fwrite(data, 1, size, patch) == size;
+		return fclose(patch) == 0 && done;
+	}
+
+	bool StreamWriter::is_seekable() const {
+		return seekable;
+	}
+
+	bool StreamWriter::failed() const {
+		return error;
+	}
+
+	// Times write() had to wait for the disk
+	unsigned int StreamWriter::get_stalls() const {
+		return stalls;
+	}
+
+	// Write out what is queued, a block at a time
+	void StreamWriter::drain(byte *block) {
+		size_t size;
+		while((size = queue.pop(block, BLOCK)) > 0) {
+			if(fwrite(block, 1, size, file) != size) {
+				error = true;
+			}
+		}
+	}
+
+	void StreamWriter::work() {
+		std::vector<byte> block(BLOCK);
+		std::unique_lock<std::mutex> guard(lock);
+		while(!quit) {
+			// Woken up for every block, the timeout catches the rest
+			queued.wait_for(guard, std::chrono::milliseconds(20));
+			guard.unlock();
+			drain(&block[0]);
+			guard.lock();
+		}
+		guard.unlock();
+		drain(&block[0]);
+	}
+}
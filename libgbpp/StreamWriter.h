@@ -0,0 +1,83 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _STREAM_WRITER_H_
+#define _STREAM_WRITER_H_
+
+#include <string>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "types.h"
+#include "RingBuffer.h"
+
+using std::string;
+
+namespace gbpp {
+
+	/**
+	 * Buffered output on its own worker thread, for captures: write()
+	 * copies the bytes into a large queue and returns, the worker takes
+	 * them to the file in big blocks. write() only waits when the queue
+	 * is full (the disk is slower than the emulation), nothing is dropped.
+	 *
+	 * A path of "-" is the standard output, so captures can be piped.
+	 */
+	class StreamWriter {
+	public:
+		static const int DEFAULT_BUFFER = 4 << 20; // bytes
+		static const int BLOCK = 64 << 10;         // bytes of a file write
+
+		StreamWriter(const size_t buffer = DEFAULT_BUFFER);
+		~StreamWriter();
+
+		bool open(const string _path);
+		void set_buffer(const size_t buffer);
+		bool is_open() const;
+		void write(const void *data, const size_t size);
+		bool rewrite(const long offset, const void *data, const size_t size);
+		void close();
+
+		bool is_seekable() const;
+		bool failed() const;
+		unsigned int get_stalls() const;
+
+	private:
+		string path;
+		FILE *file;
+		bool seekable;
+		std::atomic<bool> error;
+		std::atomic<unsigned int> stalls;
+
+		RingBuffer<byte> queue;
+		bool quit;
+		std::mutex lock;
+		std::condition_variable queued;
+		std::thread worker;
+
+		void work();
+		void drain(byte *block);
+
+		StreamWriter(const StreamWriter &);
+		StreamWriter &operator=(const StreamWriter &);
+	};
+}
+
+#endif /* _STREAM_WRITER_H_ */
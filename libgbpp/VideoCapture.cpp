@@ -0,0 +1,287 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "VideoCapture.h"
+#include "Lcd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GBPP_X86
+#include <immintrin.h>
+#endif
+
+namespace gbpp {
+
+	// Two rows of 32 bit pixels to two rows of luma and one of chroma
+	typedef void (*YuvRows)(const byte *, const byte *, const int, const bool,
+		byte *, byte *, byte *, byte *);
+
+	struct YuvKernel {
+		YuvRows rows;
+		const char *name;
+	};
+
+	// CPU clock / cycles of a frame
+	static const int RATE_NUMERATOR = 4194304;
+	static const int RATE_DENOMINATOR = 70224;
+	static const int BUFFER_SECONDS = 2;
+
+	static inline byte luma(const int r, const int g, const int b) {
+		return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	}
+
+	// r, g and b are the sums of a 2x2 block
+	static inline byte chroma_u(const int r, const int g, const int b) {
+		return ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+	}
+
+	static inline byte chroma_v(const int r, const int g, const int b) {
+		return ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+	}
+
+	static void yuv_rows_scalar(const byte *row0, const byte *row1, const int width, const bool bgra,
+			byte *y0, byte *y1, byte *u, byte *v) {
+		const int R = bgra ? 2 : 0;
+		const int B = bgra ? 0 : 2;
+		for(int x = 0; x < width; x += 2) {
+			const byte *a = row0 + x * 4, *b = row1 + x * 4;
+			y0[x] = luma(a[R], a[1], a[B]);
+			y0[x + 1] = luma(a[R + 4], a[5], a[B + 4]);
+			y1[x] = luma(b[R], b[1], b[B]);
+			y1[x + 1] = luma(b[R + 4], b[5], b[B + 4]);
+			const int r = a[R] + a[R + 4] + b[R] + b[R + 4];
+			const int g = a[1] + a[5] + b[1] + b[5];
+			const int bl = a[B] + a[B + 4] + b[B] + b[B + 4];
+			u[x / 2] = chroma_u(r, g, bl);
+			v[x / 2] = chroma_v(r, g, bl);
+		}
+	}
+
+#ifdef GBPP_X86
+	// [a0 b0 a1 b1], [a2 b2 a3 b3] to [a0+b0 a1+b1 a2+b2 a3+b3]
+	__attribute__((target("sse2")))
+	static inline __m128i pair_sums(const __m128i m0, const __m128i m1) {
+		const __m128 a = _mm_castsi128_ps(m0);
+		const __m128 b = _mm_castsi128_ps(m1);
+		return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+			_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+	}
+
+	// Luma of 4 pixels, 32 bit
+	__attribute__((target("sse2")))
+	static inline __m128i luma4_sse2(const __m128i pixels, const __m128i coefficients) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i sums = pair_sums(_mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients),
+			_mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients));
+		return _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(sums, _mm_set1_epi32(128)), 8), _mm_set1_epi32(16));
+	}
+
+	// Sums of the two 2x2 blocks of 4 pixels of two rows, 16 bit [r g b a | r g b a]
+	__attribute__((target("sse2")))
+	static inline __m128i blocks2_sse2(const __m128i p0, const __m128i p1) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(p0, zero), _mm_unpacklo_epi8(p1, zero));
+		const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(p0, zero), _mm_unpackhi_epi8(p1, zero));
+		return _mm_unpacklo_epi64(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)),
+			_mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+	}
+
+	// Chroma of 4 blocks, 32 bit
+	__attribute__((target("sse2")))
+	static inline __m128i chroma4_sse2(const __m128i b01, const __m128i b23, const __m128i coefficients) {
+		const __m128i sums = pair_sums(_mm_madd_epi16(b01, coefficients), _mm_madd_epi16(b23, coefficients));
+		return _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(sums, _mm_set1_epi32(512)), 10), _mm_set1_epi32(128));
+	}
+
+	// 16 pixels of each row per step
+	__attribute__((target("sse2")))
+	static void yuv_rows_sse2(const byte *row0, const byte *row1, const int width, const bool bgra,
+			byte *y0, byte *y1, byte *u, byte *v) {
+		const __m128i yc = bgra ? _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0)
+			: _mm_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0);
+		const __m128i uc = bgra ? _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0)
+			: _mm_setr_epi16(-38, -74, 112, 0, -38, -74, 112, 0);
+		const __m128i vc = bgra ? _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0)
+			: _mm_setr_epi16(112, -94, -18, 0, 112, -94, -18, 0);
+		int x = 0;
+		for(; x + 16 <= width; x += 16) {
+			__m128i a[4], b[4], blocks[4];
+			for(int i = 0; i < 4; i++) {
+				a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + (x + i * 4) * 4));
+				b[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + (x + i * 4) * 4));
+				blocks[i] = blocks2_sse2(a[i], b[i]);
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(y0 + x), _mm_packus_epi16(
+				_mm_packs_epi32(luma4_sse2(a[0], yc), luma4_sse2(a[1], yc)),
+				_mm_packs_epi32(luma4_sse2(a[2], yc), luma4_sse2(a[3], yc))));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(y1 + x), _mm_packus_epi16(
+				_mm_packs_epi32(luma4_sse2(b[0], yc), luma4_sse2(b[1], yc)),
+				_mm_packs_epi32(luma4_sse2(b[2], yc), luma4_sse2(b[3], yc))));
+			const __m128i us = _mm_packs_epi32(chroma4_sse2(blocks[0], blocks[1], uc),
+				chroma4_sse2(blocks[2], blocks[3], uc));
+			const __m128i vs = _mm_packs_epi32(chroma4_sse2(blocks[0], blocks[1], vc),
+				chroma4_sse2(blocks[2], blocks[3], vc));
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), _mm_packus_epi16(us, us));
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), _mm_packus_epi16(vs, vs));
+		}
+		yuv_rows_scalar(row0 + x * 4, row1 + x * 4, width - x, bgra, y0 + x, y1 + x, u + x / 2, v + x / 2);
+	}
+#endif
+
+	static YuvKernel select_yuv_kernel() {
+		YuvKernel kernel = { yuv_rows_scalar, "scalar" };
+#ifdef GBPP_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("sse2")) {
+			YuvKernel sse2 = { yuv_rows_sse2, "sse2" };
+			kernel = sse2;
+		}
+#endif
+		return kernel;
+	}
+
+	static const YuvKernel &yuv_kernel() {
+		static const YuvKernel kernel = select_yuv_kernel();
+		return kernel;
+	}
+
+	const char *yuv_kernels() {
+		return yuv_kernel().name;
+	}
+
+	static void convert_rows(const YuvRows rows, const byte *src, const int pitch, const bool bgra,
+			const int width, const int height, byte *y, byte *u, byte *v) {
+		for(int line = 0; line + 1 < height; line += 2) {
+			rows(src + line * pitch, src + (line + 1) * pitch, width, bgra,
+				y + line * width, y + (line + 1) * width, u + line / 2 * (width / 2), v + line / 2 * (width / 2));
+		}
+	}
+
+	void rgb_to_yuv420(const byte *src, const int pitch, const bool bgra, const int width,
+			const int height, byte *y, byte *u, byte *v) {
+		convert_rows(yuv_kernel().rows, src, pitch, bgra, width, height, y, u, v);
+	}
+
+	void rgb_to_yuv420_scalar(const byte *src, const int pitch, const bool bgra, const int width,
+			const int height, byte *y, byte *u, byte *v) {
+		convert_rows(yuv_rows_scalar, src, pitch, bgra, width, height, y, u, v);
+	}
+
+	// The queue of the file is sized by open(), for the frames of that size
+	VideoCapture::VideoCapture() : format(VIDEO_FILE_Y4M), width(0), height(0), frames(0), planes(0),
+			file(0) {
+	}
+
+	VideoCapture::~VideoCapture() {
+		close();
+	}
+
+	/**
+	 * Frames of width x height to path, "-" for the standard output. Both
+	 * must be even (the chroma planes are half size), else it fails. Until
+	 * the first write_frame() the frames are black.
+	 */
+	bool VideoCapture::open(const string path, const int _format, const int _width, const int _height) {
+		if(_width <= 0 || _height <= 0 || _width % 2 != 0 || _height % 2 != 0) {
+			return false;
+		}
+		format = _format;
+		width = _width;
+		height = _height;
+		frames = 0;
+		file.set_buffer(static_cast<size_t>(width) * height * 3 / 2 * 60 * BUFFER_SECONDS);
+		if(!file.open(path)) {
+			return false;
+		}
+		planes = 0;
+		if(format == VIDEO_FILE_Y4M) {
+			char header[128];
+			const int size = snprintf(header, sizeof(header),
+				"YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+				width, height, RATE_NUMERATOR, RATE_DENOMINATOR);
+			file.write(header, size);
+			planes = 6; // "FRAME\n"
+		}
+		yuv.assign(planes + width * height * 3 / 2, 128);
+		memcpy(&yuv[0], "FRAME\n", planes);
+		memset(&yuv[planes], 16, width * height);
+		return true;
+	}
+
+	bool VideoCapture::is_open() const {
+		return file.is_open();
+	}
+
+	// A new frame in one of the Lcd formats FORMAT_RGB24, FORMAT_RGBA32 or FORMAT_BGRA32
+	void VideoCapture::write_frame(const byte *src, const int pixel_format, const int pitch) {
+		if(!file.is_open()) {
+			return;
+		}
+		const byte *rgba = src;
+		int rgba_pitch = pitch;
+		if(pixel_format == Lcd::FORMAT_RGB24) {
+			pixels.resize(width * height * 4);
+			for(int y = 0; y < height; y++) {
+				const byte *in = src + y * pitch;
+				byte *out = &pixels[y * width * 4];
+				for(int x = 0; x < width; x++) {
+					out[x * 4] = in[x * 3];
+					out[x * 4 + 1] = in[x * 3 + 1];
+					out[x * 4 + 2] = in[x * 3 + 2];
+					out[x * 4 + 3] = 0;
+				}
+			}
+			rgba = &pixels[0];
+			rgba_pitch = width * 4;
+		} else if(pixel_format != Lcd::FORMAT_RGBA32 && pixel_format != Lcd::FORMAT_BGRA32) {
+			repeat_frame();
+			return;
+		}
+		byte *y = &yuv[planes];
+		rgb_to_yuv420(rgba, rgba_pitch, pixel_format == Lcd::FORMAT_BGRA32, width, height,
+			y, y + width * height, y + width * height + width * height / 4);
+		repeat_frame();
+	}
+
+	// The last frame again, for frames that were skipped or did not change
+	void VideoCapture::repeat_frame() {
+		if(!file.is_open()) {
+			return;
+		}
+		file.write(&yuv[0], yuv.size());
+		frames++;
+	}
+
+	void VideoCapture::close() {
+		file.close();
+	}
+
+	bool VideoCapture::failed() const {
+		return file.failed();
+	}
+
+	unsigned int VideoCapture::get_frames() const {
+		return frames;
+	}
+
+	// Times a frame had to wait for the file
+	unsigned int VideoCapture::get_stalls() const {
+		return file.get_stalls();
+	}
+}
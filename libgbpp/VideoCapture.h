@@ -0,0 +1,84 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _VIDEO_CAPTURE_H_
+#define _VIDEO_CAPTURE_H_
+
+#include <string>
+#include <vector>
+#include "types.h"
+#include "StreamWriter.h"
+
+using std::string;
+
+// Frame capture to YUV 4:2:0 (BT.601, limited range, chroma of every 2x2
+// block centered), for Y4M or raw I420 files and pipes to encoders.
+
+namespace gbpp {
+
+	enum { VIDEO_FILE_Y4M, VIDEO_FILE_RAW };
+
+	// Convert width x height 32 bit pixels (RGBA, or BGRA in memory when
+	// bgra) into the planes, width and height even. The SSE2 kernel gives
+	// exactly the same bytes as the scalar one.
+	void rgb_to_yuv420(const byte *src, const int pitch, const bool bgra, const int width,
+		const int height, byte *y, byte *u, byte *v);
+	void rgb_to_yuv420_scalar(const byte *src, const int pitch, const bool bgra, const int width,
+		const int height, byte *y, byte *u, byte *v);
+
+	// Name of the kernel in use: "sse2" or "scalar".
+	const char *yuv_kernels();
+
+	/**
+	 * Writes one video frame per emulated frame at the exact Game Boy rate
+	 * (4194304 / 70224 fps). The conversion is done by the caller thread
+	 * (a few microseconds), the file is written by a StreamWriter worker,
+	 * which holds about two seconds of frames. Frames are never dropped,
+	 * write_frame() waits if the file is that far behind.
+	 */
+	class VideoCapture {
+	public:
+		VideoCapture();
+		~VideoCapture();
+
+		bool open(const string path, const int format, const int width, const int height);
+		bool is_open() const;
+		void write_frame(const byte *pixels, const int pixel_format, const int pitch);
+		void repeat_frame();
+		void close();
+
+		bool failed() const;
+		unsigned int get_frames() const;
+		unsigned int get_stalls() const;
+
+	private:
+		int format;
+		int width;
+		int height;
+		unsigned int frames;
+		std::vector<byte> pixels; // 24 bit frames expanded to 32
+		std::vector<byte> yuv;    // "FRAME\n" (Y4M) and the planes
+		int planes;               // offset of the planes in yuv
+		StreamWriter file;
+
+		VideoCapture(const VideoCapture &);
+		VideoCapture &operator=(const VideoCapture &);
+	};
+}
+
+#endif /* _VIDEO_CAPTURE_H_ */
@@ -0,0 +1,125 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _GBPP_C_H_
+#define _GBPP_C_H_
+
+/*
+ * C interface, for bots, for other languages (ctypes, cffi, Rust, Go)
+ * and for embedding the shared library (libgbpp.so), which exports only
+ * these functions. The emulator components are singletons, so there is
+ * only one instance per process: gbpp_create() fails while another one
+ * exists (it is safe to race on it from several threads). A new instance
+ * starts from the default settings. No function throws, errors are
+ * return values.
+ */
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(GBPP_BUILD_SHARED)
+#define GBPP_API __declspec(dllexport)
+#elif defined(GBPP_BUILD_SHARED)
+#define GBPP_API __attribute__((visibility("default")))
+#else
+#define GBPP_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped when a function or a struct of this header changes */
+#define GBPP_ABI_VERSION 1
+
+#define GBPP_WIDTH  160
+#define GBPP_HEIGHT 144
+
+/* Input mask bits */
+enum {
+	GBPP_KEY_RIGHT  = 0x01,
+	GBPP_KEY_LEFT   = 0x02,
+	GBPP_KEY_UP     = 0x04,
+	GBPP_KEY_DOWN   = 0x08,
+	GBPP_KEY_A      = 0x10,
+	GBPP_KEY_B      = 0x20,
+	GBPP_KEY_SELECT = 0x40,
+	GBPP_KEY_START  = 0x80
+};
+
+typedef struct gbpp_emulator gbpp_emulator;
+
+/*
+ * Result of a step, valid until the next step. framebuffer is the latest
+ * complete frame, GBPP_HEIGHT rows of pitch bytes of RGB24 pixels.
+ */
+typedef struct {
+	const unsigned char *framebuffer;
+	int pitch;
+	int frame_changed;
+	unsigned int frames;
+	int frame_cycles;
+} gbpp_observation;
+
+/* GBPP_ABI_VERSION of the library, to check it against the header */
+GBPP_API int gbpp_abi_version(void);
+
+GBPP_API gbpp_emulator *gbpp_create(void);
+GBPP_API void gbpp_destroy(gbpp_emulator *gb);
+
+/* 0 on success, -1 if the rom could not be loaded */
+GBPP_API int gbpp_power_on(gbpp_emulator *gb, const char *path, int skip_bios);
+
+/* Same with a rom image in memory, it is copied */
+GBPP_API int gbpp_load_rom(gbpp_emulator *gb, const unsigned char *data, size_t size, int skip_bios);
+
+/* NULL without a rom */
+GBPP_API const gbpp_observation *gbpp_step(gbpp_emulator *gb, unsigned char input);
+GBPP_API const gbpp_observation *gbpp_step_cycles(gbpp_emulator *gb, unsigned char input, int cycles);
+
+/*
+ * Keys held from now on (GBPP_KEY_* mask) and count frames run with them.
+ * Returns the frames run, -1 without a rom.
+ */
+GBPP_API void gbpp_set_input(gbpp_emulator *gb, unsigned char input);
+GBPP_API int gbpp_step_frames(gbpp_emulator *gb, int count);
+
+/* Latest complete frame as in gbpp_observation, NULL before the first one */
+GBPP_API const unsigned char *gbpp_framebuffer(gbpp_emulator *gb, int *pitch);
+
+/*
+ * Save states in caller buffers of gbpp_state_size() bytes (0 without a
+ * rom). A state only loads with the same rom and the same library build.
+ * 0 on success, -1 if the buffer is too small or not a valid state of this
+ * game (then nothing changes).
+ */
+GBPP_API size_t gbpp_state_size(gbpp_emulator *gb);
+GBPP_API int gbpp_save_state(gbpp_emulator *gb, void *buffer, size_t size);
+GBPP_API int gbpp_load_state(gbpp_emulator *gb, const void *buffer, size_t size);
+
+/*
+ * Pointer to the memory at addr (0x8000-0xFFFF), NULL for the rom. Both
+ * return NULL or 0 without a rom.
+ */
+GBPP_API const unsigned char *gbpp_memory(gbpp_emulator *gb, unsigned short addr);
+GBPP_API unsigned char gbpp_peek(gbpp_emulator *gb, unsigned short addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GBPP_C_H_ */
@@ -27,6 +27,8 @@ namespace gbpp {
 	typedef unsigned char byte;
 	typedef char sbyte;
 
+	typedef unsigned int dword;
+
 }
 
 #endif /* _TYPES_H_ */
@@ -0,0 +1,55 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+#ifndef _BENCH_ROM_H_
+#define _BENCH_ROM_H_
+
+#include <vector>
+#include "libgbpp/GameBoy.h"
+
+namespace gbpp {
+
+	// 32 KB rom that only loops at 0x150, so a frame is (almost) all PPU
+	static std::vector<byte> bench_rom() {
+		std::vector<byte> rom(0x8000);
+		rom[0x100] = 0x00; // NOP
+		rom[0x101] = 0xC3; // JP 0x150
+		rom[0x102] = 0x50;
+		rom[0x103] = 0x01;
+		rom[0x150] = 0x18; // JR -2
+		rom[0x151] = 0xFE;
+		int sum = 0;
+		for(int i = 0x134; i <= 0x14C; i++) {
+			sum = sum - rom[i] - 1;
+		}
+		rom[0x14D] = static_cast<byte>(sum);
+		return rom;
+	}
+
+	// Varied tiles and maps, so no line looks like another
+	static void fill_vram() {
+		for(int addr = Memory::VRAM; addr < Memory::BTM0; addr++) {
+			memory.write_byte(addr, static_cast<byte>(addr * 7 + (addr >> 4)));
+		}
+		for(int addr = Memory::BTM0; addr < Memory::BTM0 + 0x800; addr++) {
+			memory.write_byte(addr, static_cast<byte>(addr * 13));
+		}
+	}
+}
+
+#endif /* _BENCH_ROM_H_ */
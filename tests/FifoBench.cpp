@@ -0,0 +1,80 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// Cost of the pixel FIFO PPU against the scanline one, per frame, with
+// and without sprites. The PPU cost is the time with the LCD on minus
+// the time with it off.
+
+#include <iostream>
+#include <chrono>
+#include "BenchRom.h"
+
+using namespace gbpp;
+
+static const int FRAMES = 1000;
+static const int LCD_ON = 0xF3; // LCD, window at 0x9C00, tiles at 0x8000, sprites, background
+
+// Microseconds per frame, SCX moves every frame so no line can be reused
+static double run_frames(GameBoy &game_boy, const byte lcdc) {
+	memory.write_byte(Memory::LCDC, lcdc);
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int frame = 0; frame < FRAMES; frame++) {
+		memory.write_byte(Memory::SCX, frame);
+		game_boy.frame();
+	}
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / FRAMES;
+}
+
+// 40 sprites, 10 on every line of the top 32
+static void set_sprites(const bool on) {
+	for(int i = 0; i < 40; i++) {
+		const word addr = Memory::OAM + i * 4;
+		memory.write_byte(addr, on ? 16 + (i / 10) * 8 : 0);
+		memory.write_byte(addr + 1, 8 + (i % 10) * 15);
+		memory.write_byte(addr + 2, i);
+		memory.write_byte(addr + 3, (i & 1) << 5);
+	}
+}
+
+int main() {
+	GameBoy game_boy;
+	const std::vector<byte> rom = bench_rom();
+	game_boy.power_on(&rom[0], rom.size(), true);
+	game_boy.set_frameskip(0);
+	memory.write_byte(Memory::LCDC, 0x00);
+	fill_vram();
+	memory.write_byte(Memory::BGP, 0xE4);
+	memory.write_byte(Memory::OBP0, 0xD2);
+	memory.write_byte(Memory::OBP1, 0x1E);
+	memory.write_byte(Memory::WY, 72);
+	memory.write_byte(Memory::WX, 87);
+
+	const double lcd_off = run_frames(game_boy, LCD_ON & 0x7F);
+	std::cout << "LCD off: " << lcd_off << " us/frame" << std::endl;
+	static const char *ppus[] = { "scanline", "FIFO" };
+	for(int sprites = 0; sprites < 2; sprites++) {
+		set_sprites(sprites != 0);
+		for(int ppu = GameBoy::PPU_SCANLINE; ppu <= GameBoy::PPU_FIFO; ppu++) {
+			game_boy.set_ppu(ppu);
+			const double frame = run_frames(game_boy, LCD_ON);
+			std::cout << ppus[ppu] << (sprites ? ", 10 sprites on 32 lines: " : ": ") << frame
+				<< " us/frame, PPU " << frame - lcd_off << " us" << std::endl;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// Scanline renderer cost, background and window a tile row at a time,
+// against the old per pixel draw_background()/draw_window() (kept below
+// as it was, reading every pixel through Memory). The PPU cost of a
+// frame is the time with the LCD on minus the time with it off.
+
+#include <iostream>
+#include <chrono>
+#include "BenchRom.h"
+
+using namespace gbpp;
+
+static const int FRAMES = 2000;
+static const int BACKGROUND_AND_WINDOW = 0xF1; // LCD, window at 0x9C00, tiles at 0x8000, background
+
+static byte screen[Lcd::HEIGHT][Lcd::WIDTH][3];
+static const int shades[4] = { 0xFFFFFF, 0xAAAAAA, 0x555555, 0x000000 };
+
+static void put_pixel(const int LY, const int pixel, const int color_num) {
+	const int color = shades[(memory.read_byte(Memory::BGP) >> (color_num * 2)) & 3];
+	if((LY >= 0) && (LY < 144) && (pixel >= 0) && (pixel < 160)) {
+		screen[LY][pixel][0] = color >> 16;
+		screen[LY][pixel][1] = color >> 8;
+		screen[LY][pixel][2] = color;
+	}
+}
+
+static void old_draw_background() {
+	const bool is_unsigned = test_bit(memory.read_byte(Memory::LCDC), 4);
+	const word tile_data = is_unsigned ? 0x8000 : 0x8800;
+	const word background_memory = test_bit(memory.read_byte(Memory::LCDC), 3) ? 0x9C00 : 0x9800;
+	const byte scroll_x = memory.read_byte(Memory::SCX);
+	const byte y_pos = memory.read_byte(Memory::SCY) + memory.read_byte(Memory::LY);
+	const word tile_row = static_cast<byte>(y_pos / 8) * 32;
+	for(int pixel = 0; pixel < Lcd::WIDTH; pixel++) {
+		const byte x_pos = pixel + scroll_x;
+		const word tile_address = background_memory + tile_row + x_pos / 8;
+		const sword tile_num = is_unsigned ? static_cast<byte>(memory.read_byte(tile_address))
+			: static_cast<sbyte>(memory.read_byte(tile_address));
+		const word tile_location = tile_data + (is_unsigned ? tile_num * 16 : (tile_num + 128) * 16);
+		const byte line = (y_pos % 8) * 2;
+		const byte data1 = memory.read_byte(tile_location + line);
+		const byte data2 = memory.read_byte(tile_location + line + 1);
+		const int color_bit = 7 - x_pos % 8;
+		put_pixel(memory.read_byte(Memory::LY), pixel, (get_bit(data2, color_bit) << 1) | get_bit(data1, color_bit));
+	}
+}
+
+static void old_draw_window() {
+	const int LY = memory.read_byte(Memory::LY);
+	const byte window_y = memory.read_byte(Memory::WY);
+	const byte window_x = memory.read_byte(Memory::WX) - 7;
+	if(LY < window_y) {
+		return;
+	}
+	const bool is_unsigned = test_bit(memory.read_byte(Memory::LCDC), 4);
+	const word tile_data = is_unsigned ? 0x8000 : 0x8800;
+	const word window_memory = test_bit(memory.read_byte(Memory::LCDC), 6) ? 0x9C00 : 0x9800;
+	const byte y_pos = LY - window_y;
+	const word tile_row = y_pos / 8 * 32;
+	for(int pixel = window_x; pixel < Lcd::WIDTH; pixel++) {
+		const byte x_pos = pixel - window_x;
+		const word tile_address = window_memory + tile_row + x_pos / 8;
+		const sword tile_num = is_unsigned ? static_cast<byte>(memory.read_byte(tile_address))
+			: static_cast<sbyte>(memory.read_byte(tile_address));
+		const word tile_location = tile_data + (is_unsigned ? tile_num * 16 : (tile_num + 128) * 16);
+		const byte line = (y_pos % 8) * 2;
+		const byte data1 = memory.read_byte(tile_location + line);
+		const byte data2 = memory.read_byte(tile_location + line + 1);
+		const int color_bit = 7 - x_pos % 8;
+		const int color_num = (get_bit(data2, color_bit) << 1) | get_bit(data1, color_bit);
+		if(color_num == 0 && !test_bit(memory.read_byte(Memory::LCDC), 1)) {
+			continue;
+		}
+		put_pixel(LY, pixel, color_num);
+	}
+}
+
+// Microseconds per frame, SCY moves every frame so no line can be reused
+static double run_frames(GameBoy &game_boy, const byte lcdc, const bool scroll) {
+	memory.write_byte(Memory::LCDC, lcdc);
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int frame = 0; frame < FRAMES; frame++) {
+		if(scroll) {
+			memory.write_byte(Memory::SCY, frame);
+		}
+		game_boy.frame();
+	}
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / FRAMES;
+}
+
+static double run_old_lines() {
+	memory.write_byte(Memory::LCDC, BACKGROUND_AND_WINDOW);
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int frame = 0; frame < FRAMES; frame++) {
+		memory.write_byte(Memory::SCY, frame);
+		for(int line = 0; line < Lcd::HEIGHT; line++) {
+			memory.set_ly(line);
+			old_draw_background();
+			old_draw_window();
+		}
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / FRAMES / Lcd::HEIGHT;
+}
+
+int main() {
+	GameBoy game_boy;
+	const std::vector<byte> rom = bench_rom();
+	game_boy.power_on(&rom[0], rom.size(), true);
+	game_boy.set_frameskip(0);
+	memory.write_byte(Memory::LCDC, 0x00);
+	fill_vram();
+	memory.write_byte(Memory::BGP, 0xE4);
+	memory.write_byte(Memory::WY, 72);
+	memory.write_byte(Memory::WX, 87);
+
+	const double lcd_off = run_frames(game_boy, BACKGROUND_AND_WINDOW & 0x7F, false);
+	const double scrolling = run_frames(game_boy, BACKGROUND_AND_WINDOW, true);
+	const double still = run_frames(game_boy, BACKGROUND_AND_WINDOW, false);
+	const double old_line = run_old_lines();
+
+	std::cout << "LCD off:        " << lcd_off << " us/frame" << std::endl;
+	std::cout << "scrolling:      " << scrolling << " us/frame, "
+		<< (scrolling - lcd_off) * 1000 / Lcd::HEIGHT << " ns/line" << std::endl;
+	std::cout << "still (reused): " << still << " us/frame, "
+		<< (still - lcd_off) * 1000 / Lcd::HEIGHT << " ns/line" << std::endl;
+	std::cout << "old per pixel background and window: " << old_line << " ns/line" << std::endl;
+	return 0;
+}
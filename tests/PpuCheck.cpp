@@ -0,0 +1,166 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// The scanline and FIFO PPUs must draw the same frame when no register
+// changes in the middle of a line: scrolled background, window (its color
+// 0 covers the background), sprites, and LCDC bit 0 clear (white under
+// the sprites whatever BGP is).
+// The scanline PPU copies the lines whose key did not change from the
+// last frame: after VRAM, OAM and register writes, the frame drawn that
+// way must be the frame drawn from scratch (loading a state drops the
+// kept lines).
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include "BenchRom.h"
+
+using namespace gbpp;
+
+static const int FRAME_SIZE = GameBoy::WIDTH * GameBoy::HEIGHT * 3;
+
+static void set_sprites() {
+	for(int i = 0; i < 40; i++) {
+		const word addr = Memory::OAM + i * 4;
+		memory.write_byte(addr, 16 + i * 3);
+		memory.write_byte(addr + 1, 4 + (i * 37) % 160);
+		memory.write_byte(addr + 2, i * 5);
+		memory.write_byte(addr + 3, (i & 3) << 5 | (i & 4) << 2 | (i & 8) << 4);
+	}
+}
+
+static void draw_frame(GameBoy &game_boy, const int ppu, byte *frame) {
+	game_boy.set_ppu(ppu);
+	game_boy.frame();
+	game_boy.frame();
+	memcpy(frame, game_boy.get_framebuffer(), FRAME_SIZE);
+}
+
+static bool check(GameBoy &game_boy, const byte lcdc) {
+	static byte scanline[FRAME_SIZE];
+	static byte fifo[FRAME_SIZE];
+	memory.write_byte(Memory::LCDC, lcdc);
+	draw_frame(game_boy, GameBoy::PPU_SCANLINE, scanline);
+	draw_frame(game_boy, GameBoy::PPU_FIFO, fifo);
+	for(int i = 0; i < FRAME_SIZE; i++) {
+		if(scanline[i] != fifo[i]) {
+			const int pixel = i / 3;
+			std::cerr << "LCDC " << std::hex << static_cast<int>(lcdc) << std::dec << ": pixel "
+				<< pixel % GameBoy::WIDTH << "," << pixel / GameBoy::WIDTH << " differs" << std::endl;
+			return false;
+		}
+	}
+	if(!(lcdc & 0x01) && !(lcdc & 0x02)) {
+		for(int i = 0; i < FRAME_SIZE; i++) {
+			if(scanline[i] != 0xFF) {
+				std::cerr << "LCDC " << std::hex << static_cast<int>(lcdc) << std::dec << ": not blank" << std::endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Writes between two frames, each one checked on its own
+struct Write {
+	word addr;
+	byte value;
+};
+
+static const Write writes[] = {
+	{ 0x8050, 0x3C },        // background tile data
+	{ 0x8050, 0x00 },        // and back
+	{ 0x9003, 0x81 },        // tile data of the 0x8800 area
+	{ Memory::BTM0 + 3, 7 }, // background map
+	{ Memory::BTM0 + 4, 6 },
+	{ 0x9C00 + 33, 0x90 },   // window map
+	{ Memory::OAM, 40 },     // sprite y, x, tile and flags
+	{ Memory::OAM + 13, 90 },
+	{ Memory::OAM + 22, 3 },
+	{ Memory::OAM + 31, 0xE0 },
+	{ 0x8000 + 25 * 16 + 2, 0x5A }, // sprite tile data
+	{ Memory::BGP, 0xE4 },
+	{ Memory::OBP0, 0x1B },
+	{ Memory::OBP1, 0x93 },
+	{ Memory::SCX, 11 },
+	{ Memory::WX, 80 },
+	{ Memory::BGP, 0x1B }
+};
+
+static bool check_reuse(GameBoy &game_boy, const byte lcdc) {
+	static byte reused[FRAME_SIZE];
+	static byte fresh[FRAME_SIZE];
+	std::vector<byte> state(game_boy.state_size());
+	game_boy.set_ppu(GameBoy::PPU_SCANLINE);
+	memory.write_byte(Memory::LCDC, 0x00); // on again at the start of a frame
+	memory.write_byte(Memory::LCDC, lcdc);
+	game_boy.frame();
+	game_boy.frame();
+	for(size_t i = 0; i < sizeof(writes) / sizeof(writes[0]); i++) {
+		memory.write_byte(writes[i].addr, writes[i].value);
+		game_boy.save_state(&state[0], state.size());
+		game_boy.frame();
+		memcpy(reused, game_boy.get_framebuffer(), FRAME_SIZE);
+		game_boy.load_state(&state[0], state.size());
+		game_boy.frame();
+		memcpy(fresh, game_boy.get_framebuffer(), FRAME_SIZE);
+		if(memcmp(reused, fresh, FRAME_SIZE) != 0) {
+			std::cerr << "LCDC " << std::hex << static_cast<int>(lcdc) << ": kept lines differ after writing "
+				<< static_cast<int>(writes[i].value) << " to " << writes[i].addr << std::dec << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main() {
+	GameBoy game_boy;
+	const std::vector<byte> rom = bench_rom();
+	game_boy.power_on(&rom[0], rom.size(), true);
+	game_boy.set_frameskip(0);
+	game_boy.use_color_scheme(0);
+	memory.write_byte(Memory::LCDC, 0x00);
+	fill_vram();
+	set_sprites();
+	memory.write_byte(Memory::BGP, 0x1B); // color 0 is black
+	memory.write_byte(Memory::OBP0, 0xD2);
+	memory.write_byte(Memory::OBP1, 0x1E);
+	memory.write_byte(Memory::SCX, 3);
+	memory.write_byte(Memory::SCY, 21);
+	memory.write_byte(Memory::WY, 40);
+	memory.write_byte(Memory::WX, 50);
+
+	static const byte configs[] = {
+		0x91, // background
+		0xB1, // window
+		0xF3, // window at 0x9C00, sprites
+		0xE7, // 0x8800 tiles, 8x16 sprites
+		0xB2, // bit 0 clear, sprites only
+		0xB0  // bit 0 clear, nothing
+	};
+	bool passed = true;
+	for(size_t i = 0; i < sizeof(configs); i++) {
+		passed = check(game_boy, configs[i]) && passed;
+	}
+	std::cout << "scanline and FIFO PPUs: " << (passed ? "ok" : "FAILED") << std::endl;
+
+	const bool reuse = check_reuse(game_boy, 0xF3) && check_reuse(game_boy, 0xE7);
+	std::cout << "kept lines: " << (reuse ? "ok" : "FAILED") << std::endl;
+	passed = passed && reuse;
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
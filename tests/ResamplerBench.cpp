@@ -0,0 +1,57 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// Resampler throughput, the selected kernel and the scalar reference,
+// at the rates the APU uses.
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include "libgbpp/Resampler.h"
+
+using namespace gbpp;
+
+static const int BLOCK = 2048;
+static const int BLOCKS = 20000;
+
+static void run(Resampler &resampler, const char *name) {
+	resampler.set_rates(131072, 48000);
+	std::vector<float> left(BLOCK), right(BLOCK);
+	for(int i = 0; i < BLOCK; i++) {
+		left[i] = static_cast<float>(i % 200 - 100);
+		right[i] = -left[i];
+	}
+	std::vector<short> out(BLOCK * 2);
+	long long made = 0;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int block = 0; block < BLOCKS; block++) {
+		resampler.write(&left[0], &right[0], BLOCK);
+		made += resampler.read(&out[0], BLOCK);
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << name << ": " << made / seconds / 1e6 << " M stereo samples/s out, "
+		<< static_cast<double>(BLOCK) * BLOCKS / seconds / 1e6 << " M in" << std::endl;
+}
+
+int main() {
+	static Resampler resampler;
+	static Resampler reference(true);
+	run(resampler, resampler_kernels());
+	run(reference, "scalar");
+	return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// The SSE2/AVX2 resampler against the scalar reference: the same samples
+// within one step of rounding, in band tones kept, tones above the output
+// Nyquist frequency removed instead of folded back, and full buffers reported.
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include "libgbpp/Resampler.h"
+
+using namespace gbpp;
+
+static const double INPUT_RATE = 131072; // Apu::INTERNAL_RATE
+static const double OUTPUT_RATE = 48000;
+static const double AMPLITUDE = 16000;
+static const int BLOCK = 2048;
+
+static Resampler resampler;
+static Resampler reference(true);
+
+// Left of a tone through both resamplers, after the filter has settled
+static void resample_tone(const double frequency, std::vector<short> &out, std::vector<short> &expected) {
+	resampler.clear();
+	reference.clear();
+	std::vector<float> left(BLOCK), right(BLOCK);
+	std::vector<short> samples(BLOCK * 2), expected_samples(BLOCK * 2);
+	long t = 0;
+	for(int block = 0; block < 40; block++) {
+		for(int i = 0; i < BLOCK; i++, t++) {
+			left[i] = static_cast<float>(AMPLITUDE * sin(2 * M_PI * frequency * t / INPUT_RATE));
+			right[i] = -left[i];
+		}
+		resampler.write(&left[0], &right[0], BLOCK);
+		reference.write(&left[0], &right[0], BLOCK);
+		const int made = resampler.read(&samples[0], BLOCK);
+		const int expected_made = reference.read(&expected_samples[0], BLOCK);
+		if(block >= 4) {
+			for(int i = 0; i < made; i++) {
+				out.push_back(samples[i * 2]);
+			}
+			for(int i = 0; i < expected_made; i++) {
+				expected.push_back(expected_samples[i * 2]);
+			}
+		}
+	}
+}
+
+static double level_db(const std::vector<short> &samples) {
+	double sum = 0;
+	for(size_t i = 0; i < samples.size(); i++) {
+		sum += samples[i] * static_cast<double>(samples[i]);
+	}
+	return 20 * log10(sqrt(sum / samples.size()) / (AMPLITUDE / sqrt(2.0)) + 1e-12);
+}
+
+static bool check_tone(const double frequency) {
+	std::vector<short> out, expected;
+	resample_tone(frequency, out, expected);
+	if(out.size() != expected.size()) {
+		std::cerr << frequency << " Hz: " << out.size() << " samples, the reference made " << expected.size() << std::endl;
+		return false;
+	}
+	for(size_t i = 0; i < out.size(); i++) {
+		if(abs(out[i] - expected[i]) > 1) {
+			std::cerr << frequency << " Hz: sample " << i << " is " << out[i] << ", the reference " << expected[i] << std::endl;
+			return false;
+		}
+	}
+	const double level = level_db(out);
+	const bool in_band = frequency < 0.45 * OUTPUT_RATE;
+	if(in_band ? fabs(level) > 0.1 : level > -70) {
+		std::cerr << frequency << " Hz: level " << level << " dB" << std::endl;
+		return false;
+	}
+	std::cout << frequency << " Hz: " << level << " dB" << std::endl;
+	return true;
+}
+
+// Input never read is dropped, and write() says so
+static bool check_overflow() {
+	std::vector<float> silence(BLOCK);
+	resampler.clear();
+	for(int written = 0; written + BLOCK <= Resampler::CAPACITY / 2; written += BLOCK) {
+		if(!resampler.write(&silence[0], &silence[0], BLOCK)) {
+			std::cerr << "write() reported an overflow with room left" << std::endl;
+			return false;
+		}
+	}
+	for(int block = 0; block < Resampler::CAPACITY / BLOCK; block++) {
+		if(!resampler.write(&silence[0], &silence[0], BLOCK)) {
+			return true;
+		}
+	}
+	std::cerr << "write() did not report the overflow" << std::endl;
+	return false;
+}
+
+int main() {
+	resampler.set_rates(INPUT_RATE, OUTPUT_RATE);
+	reference.set_rates(INPUT_RATE, OUTPUT_RATE);
+	static const double tones[] = { 1000, 15000, 30000, 45000, 60000 };
+	bool passed = true;
+	for(size_t i = 0; i < sizeof(tones) / sizeof(tones[0]); i++) {
+		passed = check_tone(tones[i]) && passed;
+	}
+	passed = check_overflow() && passed;
+	std::cout << "resampler kernel " << resampler_kernels() << ": " << (passed ? "ok" : "FAILED") << std::endl;
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
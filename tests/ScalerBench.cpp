@@ -0,0 +1,77 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// Scaler throughput of every filter on a 160x144 frame, the selected
+// kernels and the scalar reference.
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include "libgbpp/Scaler.h"
+
+using namespace gbpp;
+
+static const int WIDTH = 160;
+static const int HEIGHT = 144;
+static const int FRAMES = 2000;
+
+typedef void (*ScaleFunction)(const int, const int, const byte *, const int, const int, const int,
+	byte *, const int);
+
+// Microseconds per frame
+static double run(const ScaleFunction scale, const int filter, const int factor,
+		const std::vector<dword> &src, std::vector<dword> &dst) {
+	const int width = WIDTH * scale_factor(filter, factor);
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int frame = 0; frame < FRAMES; frame++) {
+		scale(filter, factor, reinterpret_cast<const byte *>(&src[0]), WIDTH * 4, WIDTH, HEIGHT,
+			reinterpret_cast<byte *>(&dst[0]), width * 4);
+	}
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / FRAMES;
+}
+
+int main() {
+	static const dword shades[] = { 0xFF0F380F, 0xFF306230, 0xFF8BAC0F, 0xFF9BBC0F };
+	std::vector<dword> src(WIDTH * HEIGHT);
+	std::vector<dword> dst(WIDTH * 4 * HEIGHT * 4);
+	srand(1);
+	for(size_t i = 0; i < src.size(); i++) {
+		src[i] = shades[rand() % 4];
+	}
+
+	static const struct {
+		int filter;
+		int factor;
+		const char *name;
+	} filters[] = {
+		{ FILTER_NEAREST, 2, "nearest 2x" },
+		{ FILTER_NEAREST, 3, "nearest 3x" },
+		{ FILTER_NEAREST, 4, "nearest 4x" },
+		{ FILTER_SCALE2X, 2, "scale2x" },
+		{ FILTER_SCALE3X, 3, "scale3x" },
+		{ FILTER_BLEND2X, 2, "blend2x" }
+	};
+	for(size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+		const double vector = run(scale_frame, filters[i].filter, filters[i].factor, src, dst);
+		const double scalar = run(scale_frame_scalar, filters[i].filter, filters[i].factor, src, dst);
+		std::cout << filters[i].name << ": " << scaler_kernels() << " " << vector << " us/frame, scalar "
+			<< scalar << " us/frame" << std::endl;
+	}
+	return 0;
+}
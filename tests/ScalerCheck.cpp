@@ -0,0 +1,93 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// The SSE2/AVX2 scalers must give the same pixels as the scalar reference,
+// for every filter, factor and size (the vector loops and their tails).
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include "libgbpp/Scaler.h"
+
+using namespace gbpp;
+
+static const dword SHADES[] = { 0xFF0F380F, 0xFF306230, 0xFF8BAC0F, 0xFF9BBC0F };
+
+// Mostly a few shades, like a Game Boy frame, so the edge rules are taken
+static void fill_frame(std::vector<dword> &pixels) {
+	for(size_t i = 0; i < pixels.size(); i++) {
+		pixels[i] = rand() % 8 ? SHADES[rand() % 4] : static_cast<dword>(rand());
+	}
+}
+
+static bool check(const int filter, const int factor, const int width, const int height) {
+	const int scale = scale_factor(filter, factor);
+	std::vector<dword> src(width * height);
+	std::vector<dword> reference(width * scale * height * scale);
+	std::vector<dword> vector(reference.size());
+	fill_frame(src);
+	const byte *pixels = reinterpret_cast<const byte *>(&src[0]);
+	scale_frame_scalar(filter, factor, pixels, width * 4, width, height,
+		reinterpret_cast<byte *>(&reference[0]), width * scale * 4);
+	scale_frame(filter, factor, pixels, width * 4, width, height,
+		reinterpret_cast<byte *>(&vector[0]), width * scale * 4);
+	if(vector != reference) {
+		std::cerr << "filter " << filter << " factor " << factor << ": "
+			<< width << "x" << height << " differs from the scalar reference" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// The worker thread runs the same kernels
+static bool check_worker() {
+	std::vector<dword> src(160 * 144);
+	std::vector<dword> reference(480 * 432);
+	std::vector<dword> scaled(reference.size());
+	Scaler scaler(FILTER_SCALE3X, 1);
+	for(int frame = 0; frame < 8; frame++) {
+		fill_frame(src);
+		const byte *pixels = reinterpret_cast<const byte *>(&src[0]);
+		scaler.submit(pixels, 160 * 4, 160, 144, reinterpret_cast<byte *>(&scaled[0]), 480 * 4);
+		scale_frame_scalar(FILTER_SCALE3X, 1, pixels, 160 * 4, 160, 144,
+			reinterpret_cast<byte *>(&reference[0]), 480 * 4);
+		scaler.wait();
+		if(scaled != reference) {
+			std::cerr << "Scaler worker differs from the scalar reference" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main() {
+	bool passed = true;
+	srand(1);
+	for(int filter = FILTER_NEAREST; filter <= FILTER_BLEND2X; filter++) {
+		for(int factor = 1; factor <= 4; factor++) {
+			for(int width = 1; width <= 170; width += width < 40 ? 1 : 13) {
+				for(int height = 1; height <= 9; height += 4) {
+					passed = check(filter, factor, width, height) && passed;
+				}
+			}
+		}
+	}
+	passed = check_worker() && passed;
+	std::cout << "scaler kernels " << scaler_kernels() << ": " << (passed ? "ok" : "FAILED") << std::endl;
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,89 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// Every pixel kernel the cpu supports must give the same bytes as the
+// scalar reference, on random input of every length up to a few vectors
+// (the vector loops and their tails).
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include "libgbpp/Simd.h"
+
+using namespace gbpp;
+
+static const int MAX_ROWS = 40;
+static const int MAX_COUNT = 200;
+
+static void fill(byte *data, const int size, const int mask) {
+	for(int i = 0; i < size; i++) {
+		data[i] = static_cast<byte>(rand() & mask);
+	}
+}
+
+static bool check_expand(const SimdKernels &kernels) {
+	byte data[MAX_ROWS * 2];
+	byte reference[MAX_ROWS * 8 + 1];
+	byte out[MAX_ROWS * 8 + 1];
+	for(int rows = 0; rows <= MAX_ROWS; rows++) {
+		fill(data, rows * 2, 0xFF);
+		memset(reference, 0xAA, sizeof(reference));
+		memset(out, 0xAA, sizeof(out));
+		expand_2bpp_scalar(data, rows, reference);
+		kernels.expand(data, rows, out);
+		if(memcmp(out, reference, sizeof(out)) != 0) {
+			std::cerr << kernels.name << " expand_2bpp: " << rows << " rows differ from the scalar reference" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check_colors(const SimdKernels &kernels) {
+	byte table[16];
+	byte in[MAX_COUNT];
+	byte reference[MAX_COUNT + 1];
+	byte out[MAX_COUNT + 1];
+	for(int count = 0; count <= MAX_COUNT; count++) {
+		fill(table, 16, 0xFF);
+		fill(in, count, 0x0F);
+		memset(reference, 0xAA, sizeof(reference));
+		memset(out, 0xAA, sizeof(out));
+		map_colors_scalar(in, table, count, reference);
+		kernels.colors(in, table, count, out);
+		if(memcmp(out, reference, sizeof(out)) != 0) {
+			std::cerr << kernels.name << " map_colors: " << count << " values differ from the scalar reference" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main() {
+	bool passed = true;
+	srand(1);
+	const std::vector<SimdKernels> kernels = supported_simd_kernels();
+	for(size_t i = 0; i < kernels.size(); i++) {
+		for(int round = 0; round < 20; round++) {
+			passed = check_expand(kernels[i]) && passed;
+			passed = check_colors(kernels[i]) && passed;
+		}
+		std::cout << "pixel kernels " << kernels[i].name << ": " << (passed ? "ok" : "FAILED") << std::endl;
+	}
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
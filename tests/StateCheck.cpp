@@ -0,0 +1,134 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// A state brings the machine back exactly: the frames run after loading
+// it are the frames run after saving it. A truncated state, one with a
+// flipped byte and one with a field out of range are rejected and leave
+// the running machine as it was.
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include "BenchRom.h"
+
+using namespace gbpp;
+
+static const int FRAME_SIZE = GameBoy::WIDTH * GameBoy::HEIGHT * 3;
+static const int FRAMES = 30;
+static const size_t HEADER_SIZE = 5 * sizeof(dword);
+
+// Body offset of the timer clock speed: the frame count, then the Cpu
+// (A, F, B, C, D, E, H, L, PC, SP, four flags)
+static const size_t CLOCK_SPEED_OFFSET = sizeof(unsigned int) + 8 + 4 + 4;
+
+// The same script from the same frame number, so both runs can be compared
+static void run(GameBoy &game_boy, std::vector<byte> &frames) {
+	frames.resize(FRAMES * FRAME_SIZE);
+	for(int i = 0; i < FRAMES; i++) {
+		memory.write_byte(Memory::SCX, static_cast<byte>(i * 3));
+		memory.write_byte(Memory::BGP, static_cast<byte>(0x1B + i * 0x45));
+		memory.write_byte(Memory::VRAM + (i * 97) % 0x1800, static_cast<byte>(i * 29));
+		memory.write_byte(Memory::OAM + (i * 4) % 160, static_cast<byte>(16 + i));
+		game_boy.frame();
+		memcpy(&frames[i * FRAME_SIZE], game_boy.get_framebuffer(), FRAME_SIZE);
+	}
+}
+
+static dword checksum(const byte *data, const size_t size) {
+	dword hash = 2166136261u;
+	for(size_t i = 0; i < size; i++) {
+		hash = (hash ^ data[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static std::vector<byte> save(const GameBoy &game_boy) {
+	std::vector<byte> state(game_boy.state_size());
+	game_boy.save_state(&state[0], state.size());
+	return state;
+}
+
+// The load must fail and the machine keep its state
+static bool reject(GameBoy &game_boy, const char *name, const std::vector<byte> &state, const size_t size) {
+	const std::vector<byte> before = save(game_boy);
+	if(game_boy.load_state(&state[0], size)) {
+		std::cerr << name << ": accepted" << std::endl;
+		return false;
+	}
+	if(save(game_boy) != before) {
+		std::cerr << name << ": changed the machine" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main() {
+	GameBoy game_boy;
+	const std::vector<byte> rom = bench_rom();
+	game_boy.power_on(&rom[0], rom.size(), true);
+	game_boy.set_frameskip(0);
+	game_boy.use_color_scheme(0);
+	fill_vram();
+	memory.write_byte(Memory::LCDC, 0xF3);
+	for(int i = 0; i < 10; i++) {
+		game_boy.frame();
+	}
+
+	const std::vector<byte> state = save(game_boy);
+	std::vector<byte> saved, loaded;
+	run(game_boy, saved);
+	if(!game_boy.load_state(&state[0], state.size())) {
+		std::cerr << "load failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	run(game_boy, loaded);
+	for(int i = 0; i < FRAMES; i++) {
+		if(memcmp(&saved[i * FRAME_SIZE], &loaded[i * FRAME_SIZE], FRAME_SIZE) != 0) {
+			std::cerr << "frame " << i << " differs after loading" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	std::cout << FRAMES << " frames replayed" << std::endl;
+
+	bool ok = reject(game_boy, "truncated", state, state.size() - 1);
+
+	std::vector<byte> flipped = state;
+	flipped[HEADER_SIZE + flipped.size() / 2] ^= 0x10;
+	ok = reject(game_boy, "flipped byte", flipped, flipped.size()) && ok;
+
+	// A valid checksum over a clock speed the timer does not have
+	std::vector<byte> range = state;
+	byte *body = &range[HEADER_SIZE];
+	int speed;
+	memcpy(&speed, body + CLOCK_SPEED_OFFSET, sizeof(speed));
+	if(speed != 1024) {
+		std::cerr << "clock speed not found in the state" << std::endl;
+		return EXIT_FAILURE;
+	}
+	speed = 1000;
+	memcpy(body + CLOCK_SPEED_OFFSET, &speed, sizeof(speed));
+	const dword sum = checksum(body, range.size() - HEADER_SIZE);
+	memcpy(&range[4 * sizeof(dword)], &sum, sizeof(sum));
+	ok = reject(game_boy, "clock speed out of range", range, range.size()) && ok;
+
+	if(!ok) {
+		return EXIT_FAILURE;
+	}
+	std::cout << "invalid states rejected" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+/*
+ *   Copyright (C) 2011 by Claudemiro Alves Feitosa Neto
+ *   <dimiro1@gmail.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licences>
+ */
+
+// Per frame upload cost of the Main.cpp renderers at magnification 1 to 4:
+// glDrawPixels with a zoom, a persistent texture updated with
+// glTexSubImage2D, and the same through an orphaned pixel buffer. Runs
+// off screen (EGL pbuffer), every frame is waited for with glFinish like
+// --upload-log does. On a real display use GBPP --upload-log.
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+static const int WIDTH = 160;
+static const int HEIGHT = 144;
+static const int FRAMES = 500;
+
+enum { PIXELS, TEXTURE, TEXTURE_PBO };
+static const char *renderers[] = { "pixels", "texture", "texture+pbo" };
+
+static PFNGLGENBUFFERSPROC gl_gen_buffers;
+static PFNGLBINDBUFFERPROC gl_bind_buffer;
+static PFNGLBUFFERDATAPROC gl_buffer_data;
+static PFNGLMAPBUFFERPROC gl_map_buffer;
+static PFNGLUNMAPBUFFERPROC gl_unmap_buffer;
+
+static EGLDisplay display;
+static EGLConfig config;
+static EGLContext context;
+
+static bool init_egl() {
+	// No window system needed with Mesa, else the default display
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	display = get_platform_display ? get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0)
+		: EGL_NO_DISPLAY;
+	if(display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, 0, 0) || !eglBindAPI(EGL_OPENGL_API)) {
+		return false;
+	}
+	const EGLint attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_NONE
+	};
+	EGLint configs = 0;
+	if(!eglChooseConfig(display, attributes, &config, 1, &configs) || configs == 0) {
+		return false;
+	}
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT, 0);
+	return context != EGL_NO_CONTEXT;
+}
+
+// Milliseconds per frame of a renderer, drawn to a window of the magnification
+static double run(const int renderer, const int magnification, const std::vector<unsigned char> &frame) {
+	const EGLint size[] = { EGL_WIDTH, WIDTH * magnification, EGL_HEIGHT, HEIGHT * magnification, EGL_NONE };
+	EGLSurface surface = eglCreatePbufferSurface(display, config, size);
+	eglMakeCurrent(display, surface, surface, context);
+	glViewport(0, 0, WIDTH * magnification, HEIGHT * magnification);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	GLuint texture = 0;
+	GLuint pixel_buffer = 0;
+	if(renderer != PIXELS) {
+		glEnable(GL_TEXTURE_2D);
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, WIDTH, HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	}
+	if(renderer == TEXTURE_PBO) {
+		gl_gen_buffers(1, &pixel_buffer);
+	}
+
+	const int frame_size = static_cast<int>(frame.size());
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int i = 0; i < FRAMES; i++) {
+		if(renderer == PIXELS) {
+			glRasterPos2i(-1, 1);
+			glPixelZoom(magnification, -magnification);
+			glDrawPixels(WIDTH, HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, &frame[0]);
+		} else {
+			const void *pixels = &frame[0];
+			if(pixel_buffer) {
+				gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+				gl_buffer_data(GL_PIXEL_UNPACK_BUFFER, frame_size, NULL, GL_STREAM_DRAW);
+				void *mapped = gl_map_buffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+				memcpy(mapped, &frame[0], frame_size);
+				gl_unmap_buffer(GL_PIXEL_UNPACK_BUFFER);
+				pixels = 0;
+			}
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+			if(pixel_buffer) {
+				gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			glBegin(GL_QUADS);
+			glTexCoord2f(0, 0); glVertex2f(-1, 1);
+			glTexCoord2f(1, 0); glVertex2f(1, 1);
+			glTexCoord2f(1, 1); glVertex2f(1, -1);
+			glTexCoord2f(0, 1); glVertex2f(-1, -1);
+			glEnd();
+		}
+		glFinish();
+	}
+	const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	if(texture) {
+		glDeleteTextures(1, &texture);
+		glDisable(GL_TEXTURE_2D);
+	}
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroySurface(display, surface);
+	return elapsed / FRAMES;
+}
+
+int main() {
+	if(!init_egl()) {
+		std::cerr << "no EGL OpenGL context, nothing measured" << std::endl;
+		return 0;
+	}
+	gl_gen_buffers = (PFNGLGENBUFFERSPROC) eglGetProcAddress("glGenBuffers");
+	gl_bind_buffer = (PFNGLBINDBUFFERPROC) eglGetProcAddress("glBindBuffer");
+	gl_buffer_data = (PFNGLBUFFERDATAPROC) eglGetProcAddress("glBufferData");
+	gl_map_buffer = (PFNGLMAPBUFFERPROC) eglGetProcAddress("glMapBuffer");
+	gl_unmap_buffer = (PFNGLUNMAPBUFFERPROC) eglGetProcAddress("glUnmapBuffer");
+
+	std::vector<unsigned char> frame(WIDTH * HEIGHT * 3);
+	for(size_t i = 0; i < frame.size(); i++) {
+		frame[i] = static_cast<unsigned char>(i * 7 + i / 480);
+	}
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+	std::cout << reinterpret_cast<const char *>(glGetString(GL_RENDERER)) << std::endl;
+	for(int magnification = 1; magnification <= 4; magnification++) {
+		for(int renderer = PIXELS; renderer <= TEXTURE_PBO; renderer++) {
+			std::cout << renderers[renderer] << " " << magnification << "x: "
+				<< run(renderer, magnification, frame) << " ms/frame" << std::endl;
+		}
+	}
+	return 0;
+}